@@ -0,0 +1,35 @@
+// swift-tools-version:5.3
+//
+//  Presto is still meant to be dropped into a project as-is (see Installation in the README); this manifest
+//  exists so the tests and benchmarks have something to build against, e.g.
+//
+//  xcodebuild test -scheme Presto-Package -destination 'platform=iOS Simulator,name=iPhone 15'
+
+import PackageDescription
+
+let package = Package(
+	name: "Presto",
+	platforms: [.iOS(.v11)],
+	products: [
+		.library(name: "Presto", targets: ["Presto"]),
+	],
+	targets: [
+		.target(
+			name: "Presto",
+			path: "Presto",
+			publicHeadersPath: ".",
+			linkerSettings: [.linkedFramework("UIKit"), .linkedLibrary("compression")]
+		),
+
+		// a stand-in server and synthetic payloads shared by the tests and benchmarks
+		.target(name: "PrestoTestSupport", dependencies: ["Presto"], path: "Tests/PrestoTestSupport"),
+
+		.testTarget(
+			name: "PrestoTests",
+			dependencies: ["Presto", "PrestoTestSupport"],
+			path: "Tests/PrestoTests",
+			linkerSettings: [.linkedLibrary("z")] // an independent gzip CRC to check ours against
+		),
+		.testTarget(name: "PrestoBenchmarks", dependencies: ["Presto", "PrestoTestSupport"], path: "Tests/PrestoBenchmarks"),
+	]
+)
@@ -88,6 +88,7 @@
 
 - (PrestoMetadata *)putSelf;
 - (PrestoMetadata *)postSelf;
+- (PrestoMetadata *)patchSelf;
 
 - (PrestoMetadata *)reload;
 - (PrestoMetadata *)reloadIfOlderThan:(NSTimeInterval)age;
@@ -97,5 +98,7 @@
 - (PrestoMetadata *)onComplete:(PrestoCallback)success failure:(PrestoCallback)failure;
 - (PrestoMetadata *)onChange:(PrestoCallback)dependency;
 - (PrestoMetadata *)onChange:(PrestoCallback)dependency forLifetimeOf:(id)target;
+- (PrestoMetadata *)onChangeWithDiff:(PrestoDiffCallback)dependency;
+- (PrestoMetadata *)onChangeWithDiff:(PrestoDiffCallback)dependency forLifetimeOf:(id)target;
 
 @end
@@ -94,6 +94,10 @@
 	return [self.presto postSelf];
 }
 
+- (PrestoMetadata *)patchSelf {
+	return [self.presto patchSelf];
+}
+
 #pragma mark -
 
 - (PrestoMetadata *)reload {
@@ -126,4 +130,12 @@
 	return [self.presto onChange:dependency forLifetimeOf:target];
 }
 
+- (PrestoMetadata *)onChangeWithDiff:(PrestoDiffCallback)dependency {
+	return [self.presto onChangeWithDiff:dependency];
+}
+
+- (PrestoMetadata *)onChangeWithDiff:(PrestoDiffCallback)dependency forLifetimeOf:(id)target {
+	return [self.presto onChangeWithDiff:dependency forLifetimeOf:target];
+}
+
 @end
@@ -36,15 +36,31 @@
 @class PrestoCallbackRecord;
 @class PrestoSource;
 @class PrestoMetadata;
+@class PrestoResponseCache;
+@class PrestoArrayDiff;
+@class PrestoRequestMetrics;
 
 typedef void (^PrestoCallback)(NSObject *result);
+typedef void (^PrestoDiffCallback)(NSObject *result, PrestoArrayDiff *diff); // diff is nil when the whole array should be treated as changed
+typedef NSURL *(^PrestoPageExtractor)(id responseObject, NSURL *pageURL); // returns the url of the page after this one, or nil if this was the last
 // we should consider adding PrestoFailureCallback which also passes an NSError *error
 typedef void (^PrestoRequestTransformer)(NSMutableURLRequest *request); // rename Transformation?
-typedef id (^PrestoResponseTransformer)(id response); // sent the decoded JSON object (NSArray* or NSDictionary*)
+typedef id (^PrestoResponseTransformer)(id response); // sent the decoded JSON object (NSArray* or NSDictionary*) on the manager's decodeQueue
+
+// what gets printed; checked before anything is formatted, so categories that are off cost nothing
+typedef NS_OPTIONS(NSUInteger, PrestoLogOptions) {
+	PrestoLogNone		= 0,
+	PrestoLogPayloads	= 1 << 0, // every request and response body
+	PrestoLogHeaders	= 1 << 1,
+	PrestoLogWarnings	= 1 << 2,
+	PrestoLogErrors		= 1 << 3,
+	PrestoLogVerbose	= 1 << 4,
+	PrestoLogZombies	= 1 << 5, // requests and responses nothing is waiting on anymore
+};
 
 // these are empty protocols that allow us to attribute properties with meta information
 // note that protocols can only be attached to object types, so you should declare your property as NSNumber if you need to attach a protocol to a numerical or boolean type.
-@protocol Identifying; // TODO: this will eventually be used to more efficiently equate objects when an array is loaded; for now only isEqual: is supported
+@protocol Identifying; // TODO: this will eventually be used to more efficiently equate objects when an array is loaded; for now implement identifyingKey instead
 @protocol SortKey; // TODO: use this to know what property to sort mutable arrays on (optional)
 @protocol DoNotSerialize; // maybe rename to Secure (or add a Secure that will never be serialized)
 // should we add a Serialize property as well to act as a whitelist?
@@ -52,20 +68,47 @@ typedef id (^PrestoResponseTransformer)(id response); // sent the decoded JSON o
 @protocol PrestoDelegate
 
 @optional
+// objects instantiated from a response are loaded off the target queue (on decodeQueue, or as a streamed response arrives) before anything else can see them
+// so these are only called on the target queue for objects that are already live (targets, and registered instances loaded in place)
 - (void)objectWillLoad:(id)jsonObject;
 - (void)objectDidLoad;
 
 - (void)connectionDropped;
 - (void)connectionEstablished;
 - (void)authenticationFailed;		// this is meant to alert the app globally that an authentication has failed, not actually handle the failure
+- (void)requestDidFinishWithMetrics:(PrestoRequestMetrics *)metrics; // called on the target queue after the request's callbacks have run; nothing is measured unless the manager's delegate implements this
 
 - (NSURL *)identifyingURL;
 - (id<NSCopying>)identifyingKey; // override to provide a unique identifier for an instance (enables singleton in-place loading)
+// implement one of these as well to find an existing instance straight from the incoming JSON, before a new one is allocated and loaded
+// the key must be equal to what identifyingKey returns once the instance is loaded
+// note an existing instance is not reloaded if the incoming dictionary is identical to the one it was last loaded from
++ (NSString *)identifyingField; // the JSON field holding the identifying key, e.g. @"id"
++ (id<NSCopying>)identifyingKeyForDictionary:(NSDictionary *)dictionary;
 //- (NSString *)identifyingTemplate; // return something like "http://.../%@"
 - (NSArray *)serializingKeys; // serializableProperties
 
 @end
 
+/**
+	Encodes request bodies and decodes response bodies of one content type. Presto ships with `PrestoJSONCodec` (the default) and `PrestoMessagePackCodec`; other formats can be added with `registerCodec:`.
+	
+	Decoded objects must use mutable containers (NSMutableDictionary and NSMutableArray), as they are bound into targets in place. Compression is separate: responses are inflated transparently by NSURLSession, which negotiates gzip, deflate and br itself, and request bodies can be gzipped with `withCompressedPayload`.
+*/
+@protocol PrestoCodec <NSObject>
+
+@property (readonly, nonatomic) NSString *contentType; // e.g. application/json
+- (id)objectWithData:(NSData *)data; // nil if data can't be decoded
+- (NSData *)dataWithObject:(id)object; // object is a tree of dictionaries, arrays, strings, numbers and nulls
+
+@end
+
+@interface PrestoJSONCodec : NSObject <PrestoCodec>
+@end
+
+@interface PrestoMessagePackCodec : NSObject <PrestoCodec> // application/msgpack; ext types decode as null
+@end
+
 /**
 	The Presto class represents a common access point for most global operations within the framework. For example, the `objectOfClass:`, `arrayOfClass:`, `getFromURL:`, etc. methods are replicated as class methods upon this class and provide an alternate means to instantiate objects than creating them directly.
 	
@@ -77,12 +120,32 @@ typedef id (^PrestoResponseTransformer)(id response); // sent the decoded JSON o
 @property (strong, nonatomic) NSMutableDictionary *classIndex; // 2D index of instances by class
 @property (strong, nonatomic) Class defaultErrorClass;
 @property (nonatomic) NSInteger activeRequests;
+@property (readonly, nonatomic) NSInteger coalescedRequests; // the number of GETs that were not sent because an equivalent request was already in flight
+@property (nonatomic) NSInteger maxConcurrentRequests; // requests beyond this many wait in a queue ordered by priority; 0 means unlimited; default 6
+@property (readonly, nonatomic) NSInteger queuedRequests; // requests waiting for a free slot
+@property (strong, nonatomic) NSURLSessionConfiguration *sessionConfiguration; // used for the session all requests are sent through (e.g. to tune connections per host); defaults to defaultSessionConfiguration
 @property (nonatomic) BOOL trackParentObjects; // default YES
 @property (nonatomic) BOOL showActivityIndicator; // default YES
 @property (nonatomic) BOOL ignoreNulls; // default YES -- when YES, in-place loading skips over null-valued fields in the response instead of overwriting the existing value with null
+@property (strong, nonatomic) dispatch_queue_t decodeQueue; // responses are parsed and their native objects constructed here; defaults to a private concurrent queue so sources decode in parallel
+@property (strong, nonatomic) dispatch_queue_t targetQueue; // loaded data is committed onto live targets and callbacks are delivered here; defaults to the main queue
+@property (strong, nonatomic) PrestoResponseCache *responseCache; // opt-in persistent cache of GET responses (nil by default)
+@property (strong, nonatomic) id<PrestoCodec> defaultCodec; // used by sources that don't choose their own (see withCodec:); default PrestoJSONCodec
+@property (nonatomic) NSUInteger payloadRetentionLimit; // successful response bodies up to this many bytes are kept for lastResponseString; default 0 keeps none (error bodies are always kept)
+
+// refreshes (see refreshInterval) and offline retries are all driven by a single scheduler per manager
+@property (nonatomic) NSTimeInterval refreshTolerance; // refreshes falling due within this window of each other are sent together; default 1 second
+@property (nonatomic) double refreshJitter; // each delay is randomly shortened or lengthened by up to this fraction so sources don't fire in lockstep; default 0.1
+@property (nonatomic) NSTimeInterval maxBackoffInterval; // repeated failures double a source's delay up to this cap (or its refresh interval if longer); default 60 seconds
+@property (nonatomic) BOOL pausesRefreshingInBackground; // pause refreshing while the app is in the background and resume it when it returns to the foreground; default YES
+@property (readonly, nonatomic) BOOL isRefreshPaused;
+@property (readonly, nonatomic) NSUInteger scheduledRefreshCount; // the number of sources waiting on a refresh or retry
+@property (readonly, nonatomic) NSDate *nextRefreshDate; // when the scheduler will next fire, or nil if nothing is scheduled
 
 + (Presto *)defaultInstance;
 + (Class)defaultErrorClass;
++ (PrestoLogOptions)logOptions; // shared by every manager; default warnings, errors and zombies
++ (void)setLogOptions:(PrestoLogOptions)logOptions;
 
 // these are duplicated here for convenience and apply to [Presto defaultInstance]
 + (void)globallyMapRemoteField:(NSString *)field toLocalProperty:(NSString *)property;
@@ -112,6 +175,16 @@ typedef id (^PrestoResponseTransformer)(id response); // sent the decoded JSON o
 - (id)instantiateClass:(Class)class withDictionary:(NSDictionary *)dict;
 - (void)registerInstance:(id)instance;
 
+// responses are decoded with the codec registered for their Content-Type, if any (JSON and MessagePack are registered by default)
+- (void)registerCodec:(id<PrestoCodec>)codec;
+- (id<PrestoCodec>)codecForContentType:(NSString *)contentType;
+
+/**
+	Stops all scheduled refreshes and retries from firing until `resumeRefreshing`. This already happens in the background (see `pausesRefreshingInBackground`); a pause asked for here lasts through returning to the foreground. Anything that falls due while paused is spread out over its jitter window once refreshing resumes, rather than all being sent at once.
+*/
+- (void)pauseRefreshing;
+- (void)resumeRefreshing;
+
 - (void)globallyMapRemoteField:(NSString *)field toLocalProperty:(NSString *)property;
 - (void)addGlobalRequestTransformer:(PrestoRequestTransformer)transformer;
 - (void)addGlobalResponseTransformer:(PrestoResponseTransformer)transformer;
@@ -158,6 +231,46 @@ typedef id (^PrestoResponseTransformer)(id response); // sent the decoded JSON o
 
 @property (weak, nonatomic) id owner;
 @property (nonatomic) BOOL hasOwner;
+@property (strong, nonatomic) PrestoDiffCallback diffSuccess; // called instead of success when registered with onChangeWithDiff:
+
+@end
+
+/**
+	Describes how a mutable array changed during a load, in a form that can be handed straight to batch table and collection view updates.
+	
+	Elements are matched between loads by their `identifyingKey` if they provide one, otherwise by `isEqual:`. Removed and updated indexes refer to the array before the load, inserted indexes to the array after it. Moves are only reported for elements whose order changed relative to the other surviving elements, not for those that merely shifted because of insertions or removals.
+*/
+@interface PrestoArrayDiff : NSObject
+
+@property (readonly, nonatomic) NSIndexSet *insertedIndexes;
+@property (readonly, nonatomic) NSIndexSet *removedIndexes;
+@property (readonly, nonatomic) NSIndexSet *updatedIndexes;
+@property (readonly, nonatomic) NSArray *moves; // pairs of @[@(fromIndex), @(toIndex)]
+@property (readonly, nonatomic) BOOL hasChanges;
+
+@end
+
+/**
+	Where the time went for a single load, from the moment its request was queued until its callbacks had run. Delivered to the manager's delegate through `requestDidFinishWithMetrics:`.
+	
+	Times are in seconds. Streamed responses are parsed as they arrive, so their parse time overlaps the network time rather than following it. Loads that are cancelled or retried because the connection dropped are not reported.
+*/
+@interface PrestoRequestMetrics : NSObject
+
+@property (readonly, nonatomic) NSURLRequest *request;
+@property (readonly, nonatomic) NSInteger statusCode;
+@property (readonly, nonatomic) NSURLSessionTaskMetrics *taskMetrics;	// nil if the session didn't report any (e.g. the request never started)
+@property (readonly, nonatomic) NSTimeInterval queueWait;				// waiting for a free slot (see maxConcurrentRequests)
+@property (readonly, nonatomic) NSTimeInterval network;				// the task's interval, from taskMetrics when available
+@property (readonly, nonatomic) NSTimeInterval parse;					// decoding the payload with the source's codec
+@property (readonly, nonatomic) NSTimeInterval transform;				// response transformers
+@property (readonly, nonatomic) NSTimeInterval bind;					// constructing native objects and loading them into the target, excluding diff
+@property (readonly, nonatomic) NSTimeInterval diff;					// matching array elements against the current contents and working out moves
+@property (readonly, nonatomic) NSTimeInterval callbackDispatch;		// from the load finishing until all of its callbacks had run
+@property (readonly, nonatomic) NSUInteger requestBytes;
+@property (readonly, nonatomic) NSUInteger responseBytes;
+@property (readonly, nonatomic) NSUInteger objectsInstantiated;		// native objects allocated
+@property (readonly, nonatomic) NSUInteger objectsReused;				// registered instances loaded in place instead (see identifyingKey)
 
 @end
 
@@ -175,9 +288,14 @@ typedef id (^PrestoResponseTransformer)(id response); // sent the decoded JSON o
 @property (strong, nonatomic) NSString* method;				// the last HTTP method used to load this object
 @property (strong, nonatomic) NSObject *payload;			// outgoing payload reference
 @property (strong, nonatomic) NSData *payloadData;			// outgoing payload data
-@property (strong, nonatomic) NSData *lastPayload;			// last incoming payload
+@property (strong, nonatomic) NSData *lastPayload;			// last incoming payload, if retained (see payloadRetentionLimit; never for successful streamed responses)
+@property (strong, nonatomic) NSNumber *lastPayloadDigest;	// digest of the last incoming payload, used for change detection
 @property (strong, nonatomic) id serializationTemplate;		// template for serializing the payload
+@property (strong, nonatomic) id<PrestoCodec> codec;			// the payload is encoded with this, and responses are asked for in it; nil uses the manager's defaultCodec
+@property (nonatomic) BOOL compressesPayload;				// gzip the payload (sent with Content-Encoding: gzip)
 @property (nonatomic) NSInteger statusCode;					// the last HTTP status code
+@property (strong, nonatomic) NSString *entityTag;			// the ETag of the last 200 response, sent back as If-None-Match
+@property (strong, nonatomic) NSString *lastModified;		// the Last-Modified of the last 200 response, sent back as If-Modified-Since
 @property (strong, nonatomic) NSError* error;				// we received an error from the last request
 @property (strong, nonatomic) id errorResponse;		// can probably improve this name
 @property (nonatomic) NSTimeInterval refreshInterval;
@@ -197,6 +315,24 @@ typedef id (^PrestoResponseTransformer)(id response); // sent the decoded JSON o
 
 @end
 
+/**
+	A persistent, size-bounded cache of GET responses that lets objects be populated from their last known state immediately on launch, while they are revalidated with the server.
+	
+	Entries are appended to a single memory-mapped file alongside their ETag, Last-Modified and loaded time. The least recently used entries are evicted once the cache grows beyond its capacity. Streamed responses are not cached, as their payloads are never retained.
+*/
+@interface PrestoResponseCache : NSObject
+
+@property (readonly, nonatomic) NSString *path;
+@property (nonatomic) NSUInteger capacity;			// in bytes; default 10 MB
+@property (readonly, nonatomic) NSUInteger size;		// bytes currently held by live entries
+
+- (instancetype)initWithPath:(NSString *)path;
+- (instancetype)initWithPath:(NSString *)path capacity:(NSUInteger)capacity;
+
+- (void)removeAllEntries;
+
+@end
+
 // TODO: since this by and large the main class in Presto perhaps we should rename this class to Presto and rename the Presto class to something like PrestoManager or PrestoContext
 // of course we'd want to move the global class methods down here to keep the syntax the same.
 @interface PrestoMetadata : NSObject
@@ -218,22 +354,33 @@ typedef id (^PrestoResponseTransformer)(id response); // sent the decoded JSON o
 @property (readonly, nonatomic) BOOL isLoading;
 @property (readonly, nonatomic) BOOL isLoaded;
 @property (readonly, nonatomic) BOOL isCompleted;	// all of the object's sources are either loaded or errored
+@property (readonly, nonatomic) BOOL isStale;		// the target holds a cached response that has not been revalidated with the server yet
 //@property (readonly, nonatomic) BOOL isSuccessful;	// true if the server returned 200 and the object was successfully loaded
 @property (readonly, nonatomic) NSError *error;					// we received an error from the last request
 @property (readonly, nonatomic) id errorResponse;		// the (possibly classed) response object from the last request
 @property (readonly, nonatomic) NSInteger statusCode;
 //@property (strong, nonatomic) NSDate* lastUpdate;
-//@property (strong, nonatomic) NSMutableArray* completions;
-//@property (strong, nonatomic) NSMutableArray* dependencies;
-@property (strong, nonatomic) NSMutableArray* callbacks;
+@property (readonly, nonatomic) NSMutableOrderedSet *completions;		// PrestoCompletionRecords waiting on the next load; each is removed once it is called
+@property (readonly, nonatomic) NSMutableOrderedSet *dependencies;	// PrestoDependencyRecords called on every change
+@property (readonly, nonatomic) NSArray *callbacks;					// a snapshot of both
 @property (nonatomic) NSTimeInterval refreshInterval;
-@property (readonly, nonatomic) NSString *lastResponseString;
+@property (nonatomic) BOOL materializesLazily; // keep raw elements in the target collection and only instantiate the native class as they are read (see withLazyMaterialization)
+@property (nonatomic) BOOL streamsResponse; // decode the response incrementally as it arrives instead of buffering it (see withStreamedResponse)
+@property (nonatomic) float priority; // higher priority requests are started first when requests are queued, and are prioritized on the connection; defaults to NSURLSessionTaskPriorityDefault
+@property (nonatomic) BOOL tracksChanges; // remember what each field was when the target was last loaded, so changedFields and patchSelf can tell what has been modified since (see withChangeTracking)
+@property (readonly, nonatomic) NSArray *changedFields; // names of the fields whose value differs from the last load; all of them if changes aren't being tracked
+@property (readonly, nonatomic) NSString *lastResponseString;	// only available for retained payloads (see payloadRetentionLimit)
 @property (readonly, nonatomic) id lastResponseObject;
 
 // array-related properties (these only apply if target is NSMutableArray)
 //@property (strong, nonatomic) Class arrayClass;		// the class of elements if target is a mutable array **deprecated**
 @property (nonatomic) BOOL append; // only applies to arrays; when YES, new elements are appended to the target array and existing elements are not removed (TODO: this should probably also apply to dictionaries)
 @property (strong, nonatomic) NSString *sortKey; // experimental--automatically sort an array based on some key (it would be nice if this could also be set up with a protocol)
+@property (strong, nonatomic) PrestoPageExtractor nextPageExtractor; // finds the next page in each response (see withPagination:)
+@property (readonly, nonatomic) NSURL *nextPageURL;
+@property (readonly, nonatomic) BOOL hasMorePages;
+@property (readonly, nonatomic) BOOL isLoadingPage;
+@property (nonatomic) NSUInteger prefetchDistance; // load the next page once an element this close to the end is consumed; 0 (the default) disables prefetching
 
 - (PrestoMetadata *)reload; // replace with getSelf?
 - (PrestoMetadata *)reload:(BOOL)force;
@@ -247,8 +394,26 @@ typedef id (^PrestoResponseTransformer)(id response); // sent the decoded JSON o
 	Experimental. The idea here is you can call `loadWithObject` on an existing instance to load it in place with the result of some other remote source such as a PUT or POST, rather than replacing it with a new instance.
 */
 - (PrestoMetadata *)loadWithObject:(NSObject *)object;
+/**
+	Loads the source of another object and appends its elements to this array, leaving that object's source where it is. Elements that are already in the array (by `identifyingKey`, or by content) are loaded in place rather than duplicated.
+*/
 - (PrestoMetadata *)appendFrom:(NSObject *)source;
 
+/**
+	Pages an array target. Each response (before any response transformers) is passed to `extractor` to find the next page, which `loadNextPage` then appends to the array as with `appendFrom:`.
+	
+	Reloading the array only refreshes the part of it that came from the first page, so the pages after it are kept along with their cursor.
+*/
+- (PrestoMetadata *)withPagination:(PrestoPageExtractor)extractor;
+- (PrestoMetadata *)withNextPageField:(NSString *)keyPath; // the next page's url is at keyPath in the response
+- (PrestoMetadata *)withCursorField:(NSString *)keyPath parameter:(NSString *)parameter; // the cursor at keyPath is sent as the given query parameter of the first page's url
+- (PrestoMetadata *)withPrefetchDistance:(NSUInteger)distance;
+- (PrestoMetadata *)loadNextPage; // returns the page being loaded, or nil if there are no more pages or one is already loading
+/**
+	Tells a paged array that the element at `index` is being displayed, so the next page can be prefetched once it comes within `prefetchDistance` of the end. Call this from `tableView:cellForRowAtIndexPath:` or similar; lazily materialized arrays (see `withLazyMaterialization`) do this automatically as elements are read.
+*/
+- (void)didConsumeElementAtIndex:(NSUInteger)index;
+
 /**
 	Tells an object not to load itself automatically, even if completions or dependencies are attached. You must explicitly call `reload` when you are ready for the object to be loaded.
 */
@@ -289,6 +454,10 @@ typedef id (^PrestoResponseTransformer)(id response); // sent the decoded JSON o
 - (PrestoMetadata *)getSelf;
 - (PrestoMetadata *)putSelf; // TODO: verify that calling this on a class that implements an identifyingKey returns the current object if the response includes its id (i.e. in-place load)
 - (PrestoMetadata *)postSelf;
+/**
+	Sends a PATCH to this object's source containing only the fields in `changedFields`, and returns nil if there are none. Once the server accepts it, those fields no longer count as changed.
+*/
+- (PrestoMetadata *)patchSelf;
 - (PrestoMetadata *)deleteSelf;
 //- (void)putAndLoad; // assumes the response of the PUT is the current state of the object
 //- (void)postAndLoadSelf; // you really shouldn't need to use this one if your API is properly implemented; POST should always create a new object, so it doesn't make sense to reload an existing object with its result
@@ -302,6 +471,12 @@ typedef id (^PrestoResponseTransformer)(id response); // sent the decoded JSON o
 //- (id)arrayOfClass:(Class)class; **deprecated** // this is id to avoid type warnings
 - (PrestoMetadata *)withClass:(Class)class atDepth:(int)depth;
 - (PrestoMetadata *)withErrorClass:(Class)class atDepth:(int)depth; // NOTE: depth is not supported on this call yet
+/**
+	Defers instantiating the class given to `withClass:atDepth:` until each element is first read through `objectAtIndex:`, `objectForKey:` or enumeration. Until then the target array or dictionary holds the raw dictionaries, so a large list costs only as much as is actually viewed.
+	
+	Elements that have been read are loaded in place on reload, so they keep their identity as long as their class provides `identifyingField` or `identifyingKeyForDictionary:`. This only applies at depth 1 and to targets Presto creates itself, since those are backed by a collection that knows how to materialize its elements. Otherwise the response is bound up front as usual.
+*/
+- (PrestoMetadata *)withLazyMaterialization;
 
 - (NSString *)toJSONString;
 - (NSString *)toJSONStringWithTemplate:(id)template;
@@ -313,6 +488,27 @@ typedef id (^PrestoResponseTransformer)(id response); // sent the decoded JSON o
 
 - (PrestoMetadata *)withUsername:(NSString *)username password:(NSString *)password; // not implemented
 
+/**
+	Decodes the response incrementally as it is received rather than buffering the whole body first. Objects of the class given to `withClass:atDepth:` are instantiated as soon as their JSON closes, so parsing and binding overlap with the download and the raw payload is never held in memory.
+	
+	Successful streamed responses are not retained, so `lastResponseString` and `lastResponseObject` will be nil for them. Native classes are only bound during parsing if there are no response transformers, as those need the whole decoded payload. Streamed requests are never coalesced with equivalent in-flight requests, since their decoded tree cannot be shared.
+*/
+- (PrestoMetadata *)withStreamedResponse;
+
+/**
+	Sends the payload in the given codec's format and asks for responses in it too. The response is decoded with whichever registered codec matches its Content-Type, so a server that only speaks JSON still works. Responses are only streamed (see `withStreamedResponse`) with the JSON codec.
+*/
+- (PrestoMetadata *)withCodec:(id<PrestoCodec>)codec;
+- (PrestoMetadata *)withCompressedPayload; // gzip the request body; only worth it for large bodies, and the server must accept Content-Encoding: gzip
+
+/**
+	Sets the priority of this object's requests, for example `NSURLSessionTaskPriorityHigh` for visible content and `NSURLSessionTaskPriorityLow` for prefetching.
+	
+	GET requests are cancelled, whether queued or in flight, once nothing is waiting on the response anymore: the target of every object that asked for it has been deallocated, none of them has completions left, and every dependency was added with an owner (see `onChange:forLifetimeOf:`) that has been deallocated too.
+*/
+- (PrestoMetadata *)withPriority:(float)priority;
+- (PrestoMetadata *)withChangeTracking; // starts tracking changes from the target's current state
+
 - (PrestoMetadata *)withRequestTransformer:(PrestoRequestTransformer)transformer;
 - (PrestoMetadata *)withResponseTransformer:(PrestoResponseTransformer)transformer;
 
@@ -333,6 +529,12 @@ typedef id (^PrestoResponseTransformer)(id response); // sent the decoded JSON o
 - (PrestoMetadata *)onChange:(PrestoCallback)dependency;
 - (PrestoMetadata *)onChange:(PrestoCallback)dependency forLifetimeOf:(id)target;
 
+/**
+	Like `onChange:` but also passes a `PrestoArrayDiff` describing what changed, so a table or collection view can apply granular updates instead of reloading. Only array targets produce diffs; the diff is nil for the initial call and for any other kind of target.
+*/
+- (PrestoMetadata *)onChangeWithDiff:(PrestoDiffCallback)dependency;
+- (PrestoMetadata *)onChangeWithDiff:(PrestoDiffCallback)dependency forLifetimeOf:(id)target;
+
 - (PrestoMetadata *)clearDependencies; // TODO: we need a better way to identify dependencies so individual ones can be removed
 // i actually wonder if we should use a target/selector pattern instead…
 
@@ -32,23 +32,103 @@
 
 #import <objc/runtime.h>
 #import <UIKit/UIKit.h>
+#import <compression.h>
 #import "Presto.h"
 
-static const BOOL LOG_PAYLOADS = YES;
-static const BOOL LOG_HEADERS = NO;
-static const BOOL LOG_WARNINGS = YES;
-static const BOOL LOG_ERRORS = YES;
-static const BOOL LOG_VERBOSE = NO;
-static const BOOL LOG_ZOMBIES = YES;
+static PrestoLogOptions PrestoActiveLogOptions = PrestoLogWarnings | PrestoLogErrors | PrestoLogZombies; // see +setLogOptions:
+
+#define LOG_PAYLOADS	(PrestoActiveLogOptions & PrestoLogPayloads)
+#define LOG_HEADERS		(PrestoActiveLogOptions & PrestoLogHeaders)
+#define LOG_WARNINGS	(PrestoActiveLogOptions & PrestoLogWarnings)
+#define LOG_ERRORS		(PrestoActiveLogOptions & PrestoLogErrors)
+#define LOG_VERBOSE		(PrestoActiveLogOptions & PrestoLogVerbose)
+#define LOG_ZOMBIES		(PrestoActiveLogOptions & PrestoLogZombies)
 
 static Presto *_defaultInstance;
 static id ValueForUndefinedKey;
+static void *PrestoTargetQueueKey = &PrestoTargetQueueKey; // its value is a marker belonging to the queue, not to any one manager (see setTargetQueue:)
 
 #define PRLog(FORMAT, ...) printf("%s\n", [[NSString stringWithFormat:FORMAT, ##__VA_ARGS__] UTF8String]);
 
+// 64-bit FNV-1a; cheap enough to run over every payload byte and good enough to tell whether a payload changed
+static const uint64_t PrestoDigestSeed = 14695981039346656037ULL;
+
+static inline uint64_t PrestoDigestBytes(uint64_t digest, const void *bytes, NSUInteger length) {
+	const uint8_t *p = bytes;
+	for (NSUInteger i = 0; i < length; i++) {
+		digest ^= p[i];
+		digest *= 1099511628211ULL;
+	}
+	return digest;
+}
+
+// digests a decoded JSON value so two payloads can be compared without keeping either around
+// dictionary entries are combined order independently since equal dictionaries needn't enumerate in the same order
+static uint64_t PrestoDigestObject(id object) {
+	uint64_t digest = PrestoDigestSeed;
+	
+	if ([object isKindOfClass:[NSDictionary class]]) {
+		uint64_t entries = 0;
+		for (id key in object) {
+			uint64_t entry[2] = { PrestoDigestObject(key), PrestoDigestObject([object objectForKey:key]) };
+			entries += PrestoDigestBytes(PrestoDigestSeed, entry, sizeof(entry));
+		}
+		digest = PrestoDigestBytes(digest, "{", 1);
+		digest = PrestoDigestBytes(digest, &entries, sizeof(entries));
+	} else if ([object isKindOfClass:[NSArray class]]) {
+		digest = PrestoDigestBytes(digest, "[", 1);
+		for (id elem in object) {
+			uint64_t child = PrestoDigestObject(elem);
+			digest = PrestoDigestBytes(digest, &child, sizeof(child));
+		}
+	} else if ([object isKindOfClass:[NSString class]]) {
+		uint8_t buffer[256];
+		NSUInteger used;
+		NSRange range = NSMakeRange(0, [object length]);
+		digest = PrestoDigestBytes(digest, "\"", 1);
+		while (range.length && [object getBytes:buffer maxLength:sizeof(buffer) usedLength:&used encoding:NSUTF8StringEncoding options:0 range:range remainingRange:&range] && used)
+			digest = PrestoDigestBytes(digest, buffer, used);
+	} else if ([object isKindOfClass:[NSNumber class]]) {
+		const char *type = [object objCType]; // tells booleans and integers apart from doubles
+		digest = PrestoDigestBytes(digest, type, strlen(type));
+		if (type[0] == 'd' || type[0] == 'f') {
+			double value = [object doubleValue];
+			digest = PrestoDigestBytes(digest, &value, sizeof(value));
+		} else {
+			long long value = [object longLongValue];
+			digest = PrestoDigestBytes(digest, &value, sizeof(value));
+		}
+	} else if (object == [NSNull null]) {
+		digest = PrestoDigestBytes(digest, "n", 1);
+	} else {
+		NSUInteger hash = [object hash]; // already bound instances and anything else non-JSON
+		digest = PrestoDigestBytes(digest, &hash, sizeof(hash));
+	}
+	
+	return digest;
+}
+
+// for logging bodies that may not be text (compressed, or from a binary codec)
+static NSString *PrestoPayloadDescription(NSData *data) {
+	return [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding] ?: [NSString stringWithFormat:@"(%lu bytes)", (unsigned long)data.length];
+}
+
+static const NSTimeInterval PrestoRetryDelay = 2.0; // the first retry of a request that failed because we're offline
+static char PrestoDeallocObserverKey;
+
 #pragma mark - Presto
 
-@interface Presto ()
+@class PrestoPropertyDescriptor;
+@class PrestoClassDescriptor;
+@class PrestoStreamingTask;
+@class PrestoScheduledRefresh;
+@class PrestoQueuedRequest;
+@class PrestoJSONWriter;
+@class PrestoLoadContext;
+
+typedef void (^PrestoResponseHandler)(id jsonObject, NSData *data, NSNumber *digest, NSURLResponse *response, NSError *error);
+
+@interface Presto () <NSURLSessionDataDelegate>
 
 // these are two-dimensional dictionaries first indexed on Class
 @property (strong, nonatomic) NSMutableDictionary *fieldToPropertyMappings;
@@ -57,7 +137,308 @@ static id ValueForUndefinedKey;
 @property (strong, nonatomic) NSMutableArray *responseTransformers;
 @property (strong, nonatomic) NSMutableDictionary *serializationKeys; // dictionary of NSMutableSets
 @property (strong, nonatomic) NSMutableDictionary *warnedKeys;
+@property (strong, nonatomic) NSMutableDictionary *classDescriptors; // compiled PrestoClassDescriptors indexed on Class
+@property (strong, nonatomic) NSURLSession *session; // every request goes through this, so connections are shared
+@property (strong, nonatomic) NSMutableDictionary *streamingTasks; // PrestoStreamingTasks keyed on task identifier
+@property (strong, nonatomic) NSMutableArray *pendingRequests; // PrestoQueuedRequests waiting to start, highest priority first; also guards the request queue
+@property (strong, nonatomic) NSMutableArray *runningRequests;
+@property (strong, nonatomic) NSMutableDictionary *inFlightRequests; // queued or running PrestoQueuedRequests keyed on request equivalence
+@property (nonatomic) NSUInteger requestSequence;
+@property (readwrite, nonatomic) NSInteger coalescedRequests;
 @property (nonatomic) BOOL connectionDropped;
+@property (strong, nonatomic) PrestoJSONWriter *jsonWriter; // lock it while writing
+@property (strong, nonatomic) NSMutableDictionary *codecs; // id<PrestoCodec>s keyed on lowercased content type
+@property (strong, nonatomic) NSMutableArray *pendingCallbacks; // blocks waiting for the next hop onto the target queue; also guards itself
+@property (strong, nonatomic) NSMapTable *scheduledRefreshes; // PrestoScheduledRefreshes keyed weakly on PrestoMetadata
+@property (strong, nonatomic) dispatch_source_t refreshTimer;
+@property (readwrite, nonatomic) BOOL isRefreshPaused;
+@property (nonatomic) BOOL isPausedForBackground; // paused by us rather than the app, so ours to resume
+
+- (PrestoClassDescriptor *)descriptorForClass:(Class)class;
+- (id<NSCopying>)identifyingKeyForClass:(Class)class dictionary:(NSDictionary *)dict;
+- (void)processJSONObject:(id)object forClass:(Class)class depth:(int)depth context:(PrestoLoadContext *)context;
+- (id)instantiateClass:(Class)class withDictionary:(NSDictionary *)dict context:(PrestoLoadContext *)context;
+- (void)adjustActiveRequests:(NSInteger)delta;
+- (void)performOnTargetQueue:(dispatch_block_t)block;
+- (void)deliverCallbacks:(NSArray *)callbacks;
+- (void)streamRequest:(NSURLRequest *)request forMetadata:(PrestoMetadata *)metadata bindingClass:(Class)class atDepth:(int)depth completion:(PrestoResponseHandler)completion;
+- (void)performRequest:(NSURLRequest *)request forMetadata:(PrestoMetadata *)metadata completion:(PrestoResponseHandler)completion;
+- (void)scheduleRefreshOf:(PrestoMetadata *)metadata interval:(NSTimeInterval)interval;
+- (void)scheduleRetryOf:(PrestoMetadata *)metadata;
+- (void)cancelRetryOf:(PrestoMetadata *)metadata;
+- (void)observeDeallocationOf:(id)object;
+- (void)recordLoadOf:(PrestoMetadata *)metadata succeeded:(BOOL)succeeded;
+- (BOOL)collectsMetrics;
+
+@end
+
+#pragma mark - PrestoQueuedRequest
+
+@interface PrestoQueuedRequest : NSObject
+
+@property (strong, nonatomic) NSURLRequest *request;
+@property (strong, nonatomic) NSString *key;						// for sharing with equivalent requests, or nil if it can't be shared
+@property (strong, nonatomic) NSMutableArray *handlers;			// PrestoResponseHandlers waiting on the response
+@property (strong, nonatomic) NSHashTable *metadatas;				// weakly, everything that asked for this request
+@property (nonatomic) float priority;
+@property (nonatomic) NSUInteger sequence;						// keeps requests of equal priority in order
+@property (strong, nonatomic) PrestoStreamingTask *streamingTask;	// nil for buffered requests
+@property (strong, nonatomic) NSURLSessionTask *task;				// once started
+@property (nonatomic) BOOL isCancelled;
+@property (nonatomic) NSTimeInterval enqueuedTime;				// relative to the reference date
+@property (nonatomic) NSTimeInterval startedTime;
+@property (strong, nonatomic) NSURLSessionTaskMetrics *taskMetrics;
+
+@end
+
+// calls its block when the object it is associated with is deallocated
+@interface PrestoDeallocObserver : NSObject
+
+@property (strong, nonatomic) dispatch_block_t block;
+
+@end
+
+#pragma mark - PrestoScheduledRefresh
+
+@interface PrestoScheduledRefresh : NSObject
+
+@property (nonatomic) NSTimeInterval interval;		// the refresh interval, or 0 if the source is only waiting on a retry
+@property (nonatomic) NSTimeInterval dueTime;		// relative to the reference date
+@property (nonatomic) NSUInteger failures;			// consecutive failed loads, for backoff
+@property (nonatomic) BOOL isRetry;					// the next firing re-sends a request that failed because we were offline
+
+@end
+
+#pragma mark - PrestoPropertyDescriptor
+
+// a property's runtime attributes parsed once up front, so loading and serializing never have to touch property_getAttributes or KVC in the common case
+@interface PrestoPropertyDescriptor : NSObject
+
+@property (strong, nonatomic) Class ownerClass;		// the exact class the accessor IMPs were resolved against
+@property (strong, nonatomic) NSString *name;
+@property (strong, nonatomic) NSString *fieldName;		// the remote field name after mappings are applied
+@property (strong, nonatomic) Class propertyClass;
+@property (strong, nonatomic) Class protocolClass;		// the element class declared via protocol, e.g. NSArray<MyClass> *
+@property (nonatomic) char typeEncoding;
+@property (nonatomic) BOOL isBool;
+@property (nonatomic) BOOL isWeak;
+@property (nonatomic) BOOL isReadOnly;
+@property (nonatomic) BOOL doNotSerialize;
+@property (nonatomic) BOOL isSerialized;				// the final verdict, taking serialization keys into account
+@property (nonatomic) SEL getter;
+@property (nonatomic) SEL setter;
+@property (nonatomic) IMP getterIMP;
+@property (nonatomic) IMP setterIMP;
+
++ (instancetype)descriptorForProperty:(objc_property_t)property ofClass:(Class)class;
+
+- (id)valueForTarget:(id)target;
+- (void)setValue:(id)value forTarget:(id)target;
+
+@end
+
+#pragma mark - PrestoClassDescriptor
+
+@interface PrestoClassDescriptor : NSObject
+
+@property (strong, nonatomic) Class describedClass;
+@property (strong, nonatomic) NSDictionary *properties;			// keyed on property name
+@property (strong, nonatomic) NSDictionary *fields;				// keyed on remote field name (NSNull if the field maps to a missing property)
+@property (strong, nonatomic) NSArray *serializableProperties;	// in declaration order, subclass first
+
++ (instancetype)descriptorForClass:(Class)class manager:(Presto *)manager;
+
+- (PrestoPropertyDescriptor *)propertyForField:(NSString *)field;
+
+@end
+
+#pragma mark - PrestoJSONStreamParser
+
+typedef NS_ENUM(NSInteger, PrestoJSONState) {
+	PrestoJSONExpectValue,
+	PrestoJSONExpectValueOrEnd,	// just after [
+	PrestoJSONExpectKeyOrEnd,		// just after {
+	PrestoJSONExpectKey,
+	PrestoJSONExpectColon,
+	PrestoJSONExpectCommaOrEnd,
+	PrestoJSONExpectNothing,		// the root value is complete
+};
+
+// an incremental (push) JSON parser that builds mutable containers as bytes arrive, so a response body never has to be held in memory as a whole
+// if a bind class is supplied, dictionaries at the bind depth are instantiated as native objects as soon as they close
+@interface PrestoJSONStreamParser : NSObject
+
+@property (weak, nonatomic) Presto *manager;
+@property (strong, nonatomic) Class bindClass;
+@property (nonatomic) int bindDepth;
+@property (strong, nonatomic) PrestoLoadContext *context;	// for the instances it binds
+@property (readonly, nonatomic) NSError *error;
+
+- (BOOL)parseData:(NSData *)data;
+- (id)finish; // returns the root object, or nil if the payload was empty or malformed
+
+@end
+
+#pragma mark - PrestoJSONWriter
+
+// writes UTF-8 JSON straight into a growable buffer that is reused from one serialization to the next
+@interface PrestoJSONWriter : NSObject
+
+@property (weak, nonatomic) Presto *manager;
+@property (readonly, nonatomic) const uint8_t *bytes;
+@property (readonly, nonatomic) NSUInteger length;
+
+- (void)reset;
+- (NSData *)data; // a copy of what has been written so far
+
+- (void)writeValue:(id)value template:(id)template;
+- (void)writeObject:(NSObject *)object template:(id)template;
+- (BOOL)writePropertyValue:(id)value ofProperty:(PrestoPropertyDescriptor *)property template:(id)template; // NO if the property shouldn't be serialized
+
+@end
+
+#pragma mark - Lazy collections
+
+// a mutable array that holds raw dictionaries and only instantiates each as elementClass the first time it is read
+@interface PrestoLazyArray : NSMutableArray
+
+@property (weak, nonatomic) Presto *manager;
+@property (strong, nonatomic) Class elementClass;
+@property (weak, nonatomic) PrestoMetadata *metadata; // told as elements are read, so it can prefetch
+
+- (instancetype)initWithElementClass:(Class)class manager:(Presto *)manager;
+- (id)rawObjectAtIndex:(NSUInteger)index; // doesn't materialize
+- (BOOL)isMaterializedAtIndex:(NSUInteger)index;
+- (NSArray *)rawElements; // a snapshot of the storage, materialized or not
+
+@end
+
+// the dictionary equivalent of PrestoLazyArray
+@interface PrestoLazyDictionary : NSMutableDictionary
+
+@property (weak, nonatomic) Presto *manager;
+@property (strong, nonatomic) Class elementClass;
+
+- (instancetype)initWithElementClass:(Class)class manager:(Presto *)manager;
+- (id)rawObjectForKey:(id)key; // doesn't materialize
+
+@end
+
+#pragma mark - PrestoStreamingTask
+
+@interface PrestoStreamingTask : NSObject
+
+@property (strong, nonatomic) PrestoJSONStreamParser *parser;
+@property (strong, nonatomic) NSMutableData *bufferedData;	// used instead of the parser for non-200 responses
+@property (nonatomic) uint64_t digest;
+@property (strong, nonatomic) PrestoResponseHandler completion;
+@property (nonatomic) NSUInteger receivedBytes;
+@property (strong, nonatomic) NSMutableArray *deferredLoads;	// in-place loads found while binding, for the commit to apply
+@property (nonatomic) BOOL timesParsing;					// only while metrics are being collected
+@property (nonatomic) NSTimeInterval parseTime;
+
+@end
+
+#pragma mark - PrestoLoadContext
+
+// what a load needs to know about the request it's working for, handed down to instantiateClass: and friends (and to the metadata of anything they load)
+@interface PrestoLoadContext : NSObject
+
+@property (strong, nonatomic) PrestoRequestMetrics *metrics;	// nil unless they're being collected
+@property (strong, nonatomic) NSMutableArray *deferredLoads;	// while decoding off the target queue, in-place loads of registered instances are collected here for the commit to apply; nil loads them right away
+
++ (instancetype)contextWithMetrics:(PrestoRequestMetrics *)metrics deferredLoads:(NSMutableArray *)deferredLoads;
+
+@end
+
+#pragma mark - PrestoRequestMetrics
+
+@interface PrestoRequestMetrics ()
+
+@property (readwrite, strong, nonatomic) NSURLRequest *request;
+@property (readwrite, nonatomic) NSInteger statusCode;
+@property (readwrite, strong, nonatomic) NSURLSessionTaskMetrics *taskMetrics;
+@property (readwrite, nonatomic) NSTimeInterval queueWait;
+@property (readwrite, nonatomic) NSTimeInterval network;
+@property (readwrite, nonatomic) NSTimeInterval parse;
+@property (readwrite, nonatomic) NSTimeInterval transform;
+@property (readwrite, nonatomic) NSTimeInterval bind;
+@property (readwrite, nonatomic) NSTimeInterval diff;
+@property (readwrite, nonatomic) NSTimeInterval callbackDispatch;
+@property (readwrite, nonatomic) NSUInteger requestBytes;
+@property (readwrite, nonatomic) NSUInteger responseBytes;
+@property (readwrite, nonatomic) NSUInteger objectsInstantiated;
+@property (readwrite, nonatomic) NSUInteger objectsReused;
+@property (nonatomic) BOOL isFinished; // the response has arrived, so the next round of callbacks reports these
+
+@end
+
+#pragma mark - PrestoResponseCache
+
+@interface PrestoCacheEntry : NSObject
+
+@property (strong, nonatomic) NSString *key;
+@property (nonatomic) unsigned long long offset;		// of the record within the cache file
+@property (nonatomic) unsigned long long length;		// of the whole record
+@property (nonatomic) unsigned long long payloadOffset;
+@property (nonatomic) unsigned long long payloadLength;
+@property (strong, nonatomic) NSString *entityTag;
+@property (strong, nonatomic) NSString *lastModified;
+@property (strong, nonatomic) NSString *contentType;		// of the response, to pick the codec it is decoded with
+@property (strong, nonatomic) NSDate *loadedTime;
+@property (strong, nonatomic) NSData *payload;		// only filled in when handed out by entryForKey:
+@property (nonatomic) NSUInteger lastAccess;			// a tick of the cache's access clock, for LRU eviction
+
+@end
+
+@interface PrestoResponseCache ()
+
+- (PrestoCacheEntry *)entryForKey:(NSString *)key;
+- (void)storePayload:(NSData *)payload entityTag:(NSString *)entityTag lastModified:(NSString *)lastModified contentType:(NSString *)contentType forKey:(NSString *)key;
+
+@end
+
+#pragma mark - PrestoMetadata
+
+@interface PrestoMetadata ()
+
+@property (weak, nonatomic) id weakTarget;
+@property (readwrite, nonatomic) BOOL isStale;
+@property (nonatomic) BOOL loadChanged;						// the result of the last loadWithDictionary:/loadWithArray:
+@property (strong, nonatomic) NSNumber *loadedDigest;		// digest of the embedded JSON this target was last loaded from
+@property (strong, nonatomic) NSArray *loadedValues;			// the target's fields (or elements) right after it was last loaded, to catch local modifications (see isUnmodifiedSinceLoad)
+
+@property (strong, nonatomic) NSDictionary *fieldDigests;	// digest of each serialized field as of the last load, when tracking changes
+@property (readwrite, strong, nonatomic) NSMutableOrderedSet *completions;
+@property (readwrite, strong, nonatomic) NSMutableOrderedSet *dependencies;
+
+- (BOOL)loadSubtree:(id)jsonObject withDigest:(NSNumber *)digest;
+- (void)recordLoadedValues;
+- (NSData *)toJSONDataWithTemplate:(id)template;
+- (void)load:(BOOL)force;
+- (BOOL)hasLiveDependents;
+- (BOOL)isZombie;
+- (BOOL)materializesTargetLazily;
+@property (strong, nonatomic) PrestoArrayDiff *lastDiff;	// what the last loadWithArray: changed
+@property (nonatomic) NSUInteger loadedWindowLength;		// how many elements the window held after the last loadWithArray:inWindow:
+
+// pagination
+@property (weak, nonatomic) PrestoMetadata *pagedMetadata;	// for a page, the collection it is appended to
+@property (strong, nonatomic) PrestoMetadata *loadingPage;	// the page being loaded into this collection, if any
+@property (readwrite, nonatomic) NSURL *nextPageURL;
+@property (nonatomic) NSUInteger loadedPageCount;
+@property (nonatomic) NSUInteger firstPageLength;			// how many elements the first page covered when it last loaded
+@property (strong, nonatomic) NSURL *decodedNextPageURL;	// extracted by decodeObject:, applied when the response is loaded
+@property (nonatomic) BOOL hasDecodedPage;
+
+- (BOOL)loadWithArray:(NSArray *)array inWindow:(NSRange)window;
+
+@property (strong, nonatomic) PrestoRequestMetrics *requestMetrics; // for the request in flight, if the manager collects them
+@property (strong, nonatomic) NSMutableArray *deferredLoads;		// in-place loads found while a streamed response was bound, for the commit to apply
+@property (strong, nonatomic) PrestoLoadContext *loadContext;		// of the load in progress, while this target is being decoded or committed
+@property (strong, nonatomic) dispatch_group_t decodeGroup;		// responses being decoded or waiting to be committed
+@property (nonatomic) NSUInteger responseGeneration;				// bumped for each response handed over for decoding
+@property (nonatomic) NSUInteger committedGeneration;				// the newest one committed so far (only touched on the target queue)
 
 @end
 
@@ -79,6 +460,14 @@ static id ValueForUndefinedKey;
 	return [Presto defaultInstance].defaultErrorClass;
 }
 
++ (PrestoLogOptions)logOptions {
+	return PrestoActiveLogOptions;
+}
+
++ (void)setLogOptions:(PrestoLogOptions)logOptions {
+	PrestoActiveLogOptions = logOptions;
+}
+
 // the following are convenience proxies to [Presto defaultInstance]
 + (void)globallyMapRemoteField:(NSString *)field toLocalProperty:(NSString *)property {
 	[[Presto defaultInstance] globallyMapRemoteField:field toLocalProperty:property];
@@ -159,18 +548,43 @@ static id ValueForUndefinedKey;
 		self.responseTransformers = [NSMutableArray new];
 		self.serializationKeys = [NSMutableDictionary new];
 		self.warnedKeys = [NSMutableDictionary new];
+		self.classDescriptors = [NSMutableDictionary new];
+		self.jsonWriter = [PrestoJSONWriter new];
+		self.jsonWriter.manager = self;
+		self.codecs = [NSMutableDictionary new];
+		self.pendingCallbacks = [NSMutableArray new];
+		self.defaultCodec = [PrestoJSONCodec new];
+		[self registerCodec:self.defaultCodec];
+		[self registerCodec:[PrestoMessagePackCodec new]];
+		self.streamingTasks = [NSMutableDictionary new];
+		self.pendingRequests = [NSMutableArray new];
+		self.runningRequests = [NSMutableArray new];
+		self.inFlightRequests = [NSMutableDictionary new];
+		self.scheduledRefreshes = [NSMapTable weakToStrongObjectsMapTable];
 		self.classIndex = [NSMutableDictionary new];
 		
+		self.decodeQueue = dispatch_queue_create("presto.decode", DISPATCH_QUEUE_CONCURRENT);
+		self.targetQueue = dispatch_get_main_queue();
+		
 		self.trackParentObjects = YES;
 		self.showActivityIndicator = YES;
 		self.ignoreNulls = YES;
+		self.pausesRefreshingInBackground = YES;
+		
+		[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(applicationDidEnterBackground:) name:UIApplicationDidEnterBackgroundNotification object:nil];
+		[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(applicationWillEnterForeground:) name:UIApplicationWillEnterForegroundNotification object:nil];
+		self.maxConcurrentRequests = 6;
+		
+		self.refreshTolerance = 1;
+		self.refreshJitter = 0.1;
+		self.maxBackoffInterval = 60;
 	}
 	return self;
 }
 
 #pragma mark -
 
-- (void)processJSONObject:(id)object forClass:(Class)class depth:(int)depth {
+- (void)processJSONObject:(id)object forClass:(Class)class depth:(int)depth context:(PrestoLoadContext *)context {
 	if (object == nil || class == nil)
 		return;
 	
@@ -182,15 +596,18 @@ static id ValueForUndefinedKey;
 			id elem = [array objectAtIndex:i];
 			
 			if (depth > 1) {
-				[self processJSONObject:elem forClass:class depth:depth - 1];
+				[self processJSONObject:elem forClass:class depth:depth - 1 context:context];
 			} else { // depth == 1
+				if ([elem isKindOfClass:class])
+					continue; // already bound while streaming
+				
 				if (![elem isKindOfClass:NSDictionary.self]) {
 					if (LOG_WARNINGS)
 						PRLog(@"pRESTo Warning: Supplied class depth does not correspond to a dictionary in the response. Actual type: %@", [elem class]);
 					continue;
 				}
 				
-				id instance = [self instantiateClass:class withDictionary:elem];
+				id instance = [self instantiateClass:class withDictionary:elem context:context];
 				[array replaceObjectAtIndex:i withObject:instance];
 			}
 		}
@@ -200,15 +617,18 @@ static id ValueForUndefinedKey;
 			id elem = dictionary[key];
 			
 			if (depth > 1) {
-				[self processJSONObject:elem forClass:class depth:depth - 1];
+				[self processJSONObject:elem forClass:class depth:depth - 1 context:context];
 			} else { // depth == 1
+				if ([elem isKindOfClass:class])
+					continue; // already bound while streaming
+				
 				if (![elem isKindOfClass:NSDictionary.self]) {
 					if (LOG_WARNINGS)
 						PRLog(@"pRESTo Warning: Supplied class depth does not correspond to a dictionary in the response. Actual type: %@", [elem class]);
 					continue;
 				}
 				
-				id instance = [self instantiateClass:class withDictionary:elem];
+				id instance = [self instantiateClass:class withDictionary:elem context:context];
 				dictionary[key] = instance;
 			}
 		}
@@ -218,38 +638,113 @@ static id ValueForUndefinedKey;
 	}
 }
 
+- (void)registerCodec:(id<PrestoCodec>)codec {
+	@synchronized (self.codecs) {
+		self.codecs[codec.contentType.lowercaseString] = codec;
+	}
+}
+
+- (id<PrestoCodec>)codecForContentType:(NSString *)contentType {
+	NSString *mediaType = [[contentType componentsSeparatedByString:@";"].firstObject stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]].lowercaseString; // drop any charset etc.
+	if (!mediaType.length)
+		return nil;
+	@synchronized (self.codecs) {
+		return self.codecs[mediaType];
+	}
+}
+
+#pragma mark -
+
 - (id)instantiateClass:(Class)class withDictionary:(NSDictionary *)dict {
+	return [self instantiateClass:class withDictionary:dict context:nil];
+}
+
+- (id)instantiateClass:(Class)class withDictionary:(NSDictionary *)dict context:(PrestoLoadContext *)context {
 	if (class == nil)
 		return nil;
 	
-	// TODO: the efficiency here could be improved; we are currently performing in the worst case two loadWithDictionary calls for every call to this method
+	// if the class can tell us its identity from the raw dictionary, look for a live instance before allocating anything
+	id<NSCopying> key = [self identifyingKeyForClass:class dictionary:dict];
+	if (key) {
+		NSObject<PrestoDelegate> *existing;
+		@synchronized (self.classIndex) {
+			existing = [self.classIndex[class] objectForKey:key];
+		}
+		if (existing) {
+			context.metrics.objectsReused++;
+			[self loadExistingInstance:existing withDictionary:dict context:context];
+			return existing;
+		}
+	}
 	
 	NSObject<PrestoDelegate> *result = [[class alloc] init];
+	context.metrics.objectsInstantiated++;
 	
 	if ([result respondsToSelector:@selector(objectWillLoad:)])
 		[result objectWillLoad:dict]; // ok??
 	
+	result.presto.loadContext = context; // so whatever it instantiates in turn is counted and deferred along with it
 	[result.presto loadWithDictionary:dict];
+	result.presto.loadContext = nil;
+	[result.presto recordLoadedValues]; // so an object it's embedded in can tell whether it's been modified
 	
-	id<NSCopying> key = nil;
+	// otherwise we only learn the identity once the instance is loaded
 	if ([result respondsToSelector:@selector(identifyingKey)])
 		key = [(id<PrestoDelegate>)result identifyingKey];
 	if (key) {
-//		if (self.classIndex[class] == nil)
-//			self.classIndex[(id<NSCopying>)class] = [NSMapTable strongToWeakObjectsMapTable]; // TODO: verify!!
-		NSMapTable *instanceIndex = self.classIndex[class];
-		if ([instanceIndex objectForKey:key] != nil) {
-			if (LOG_VERBOSE)
-				PRLog(@"Presto: Found existing singleton instance %@:%@.", class, key);
-			result = [instanceIndex objectForKey:key];
-			[result.presto loadWithDictionary:dict]; // load the existing object with the (presumably) latest data
-		} else
-			[self registerInstance:result];
+		NSObject<PrestoDelegate> *existing;
+		@synchronized (self.classIndex) {
+			existing = [self.classIndex[class] objectForKey:key];
+			if (existing == nil)
+				[self registerInstance:result];
+		}
+		
+		if (existing) {
+			context.metrics.objectsReused++; // the one we allocated is thrown away
+			[self loadExistingInstance:existing withDictionary:dict context:context];
+			result = existing;
+		}
 	}
 	
 	return result;
 }
 
+- (id<NSCopying>)identifyingKeyForClass:(Class)class dictionary:(NSDictionary *)dict {
+	if ([class respondsToSelector:@selector(identifyingKeyForDictionary:)])
+		return [(Class<PrestoDelegate>)class identifyingKeyForDictionary:dict];
+	
+	if ([class respondsToSelector:@selector(identifyingField)]) {
+		id key = dict[[(Class<PrestoDelegate>)class identifyingField]];
+		return key == [NSNull null] ? nil : key;
+	}
+	
+	return nil;
+}
+
+// while decoding off the target queue, the load is left in the context for the commit to apply together with the rest
+// instead of each one blocking on the target queue
+- (void)loadExistingInstance:(NSObject *)existing withDictionary:(NSDictionary *)dict context:(PrestoLoadContext *)context {
+	if (LOG_VERBOSE)
+		PRLog(@"Presto: Found existing singleton instance %@.", existing);
+	
+	NSNumber *digest = @(PrestoDigestObject(dict));
+	PrestoLoadContext *loadContext = [PrestoLoadContext contextWithMetrics:context.metrics deferredLoads:nil]; // by the time it runs, we're on the target queue
+	
+	// the existing instance is live, so it may only be modified on the target queue
+	dispatch_block_t load = ^{
+		PrestoMetadata *metadata = existing.presto;
+		PrestoLoadContext *previous = metadata.loadContext; // it may be the very target being committed
+		metadata.loadContext = loadContext;
+		[metadata loadSubtree:dict withDigest:digest]; // load the existing object with the (presumably) latest data
+		metadata.loadContext = previous;
+	};
+	
+	if (context.deferredLoads)
+		[context.deferredLoads addObject:load];
+	else
+		[self performOnTargetQueue:load];
+}
+
 - (void)registerInstance:(id)instance {
 	if (instance == nil)
 		return;
@@ -259,124 +754,2588 @@ static id ValueForUndefinedKey;
 	if ([instance respondsToSelector:@selector(identifyingKey)])
 		key = [(id<PrestoDelegate>)instance identifyingKey];
 	if (key) {
-		if (self.classIndex[class] == nil)
-			self.classIndex[(id<NSCopying>)class] = [NSMapTable strongToWeakObjectsMapTable]; // TODO: verify!!
-		NSMapTable *instanceIndex = self.classIndex[class];
-		if (LOG_VERBOSE)
-			PRLog(@"Presto: Registering singleton instance %@:%@.", class, key);
-		[instanceIndex setObject:instance forKey:key];
+		@synchronized (self.classIndex) {
+			if (self.classIndex[class] == nil)
+				self.classIndex[(id<NSCopying>)class] = [NSMapTable strongToWeakObjectsMapTable]; // TODO: verify!!
+			NSMapTable *instanceIndex = self.classIndex[class];
+			if (LOG_VERBOSE)
+				PRLog(@"Presto: Registering singleton instance %@:%@.", class, key);
+			[instanceIndex setObject:instance forKey:key];
+		}
 	}
 }
 
 #pragma mark -
 
 - (void)setActiveRequests:(NSInteger)activeRequests {
-	_activeRequests = activeRequests;
+	BOOL wasActive;
+	@synchronized (self) {
+		wasActive = _activeRequests > 0;
+		_activeRequests = activeRequests;
+	}
 	
-	if (self.showActivityIndicator) {
+	// only hop to the main queue when the indicator actually needs to change
+	if (self.showActivityIndicator && wasActive != (activeRequests > 0)) {
 		dispatch_async(dispatch_get_main_queue(), ^{
 			[UIApplication sharedApplication].networkActivityIndicatorVisible = self.activeRequests > 0;
 		});
 	}
 }
 
+- (void)adjustActiveRequests:(NSInteger)delta {
+	@synchronized (self) {
+		self.activeRequests = _activeRequests + delta;
+	}
+}
+
+static void PrestoReleaseQueueMarker(void *marker) {
+	CFRelease(marker);
+}
+
+// several managers can share a target queue (they all default to main), so each queue is marked once with its own marker and the marker is never removed
+// that way we can tell we're running on our target queue without one manager's marking clobbering another's
+- (void)setTargetQueue:(dispatch_queue_t)targetQueue {
+	targetQueue = targetQueue ?: dispatch_get_main_queue();
+	
+	@synchronized ([Presto class]) {
+		if (!dispatch_queue_get_specific(targetQueue, PrestoTargetQueueKey))
+			dispatch_queue_set_specific(targetQueue, PrestoTargetQueueKey, (__bridge_retained void *)[NSObject new], PrestoReleaseQueueMarker);
+	}
+	
+	_targetQueue = targetQueue;
+}
+
+- (void)performOnTargetQueue:(dispatch_block_t)block {
+	dispatch_queue_t targetQueue = self.targetQueue;
+	if (dispatch_get_specific(PrestoTargetQueueKey) == dispatch_queue_get_specific(targetQueue, PrestoTargetQueueKey))
+		block();
+	else
+		dispatch_sync(targetQueue, block);
+}
+
+- (BOOL)collectsMetrics {
+	return [self.delegate respondsToSelector:@selector(requestDidFinishWithMetrics:)];
+}
+
+// everything triggered before the target queue gets around to it is delivered together in one hop, in the order it was triggered
+- (void)deliverCallbacks:(NSArray *)callbacks {
+	if (!callbacks.count)
+		return;
+	
+	BOOL scheduled;
+	@synchronized (self.pendingCallbacks) {
+		scheduled = self.pendingCallbacks.count > 0;
+		[self.pendingCallbacks addObjectsFromArray:callbacks];
+	}
+	if (scheduled)
+		return; // the hop that's already on its way will pick these up
+	
+	dispatch_async(self.targetQueue, ^{
+		NSArray *batch;
+		@synchronized (self.pendingCallbacks) {
+			batch = [self.pendingCallbacks copy];
+			[self.pendingCallbacks removeAllObjects];
+		}
+		for (dispatch_block_t callback in batch)
+			callback();
+	});
+}
+
+#pragma mark -
+
+- (void)globallyMapRemoteField:(NSString *)field toLocalProperty:(NSString *)property {
+	[self mapRemoteField:field toLocalProperty:property forClass:[NSObject class]];
+}
+
+// now that these are like this should we bother with the method or just expose the array again?
+- (void)addGlobalRequestTransformer:(PrestoRequestTransformer)transformer {
+//	[self addRequestTransformer:transformer forClass:[NSObject class]];
+	[self.requestTransformers addObject:transformer];
+}
+
+- (void)addGlobalResponseTransformer:(PrestoResponseTransformer)transformer {
+//	[self addResponseTransformer:transformer forClass:[NSObject class]];
+	[self.responseTransformers addObject:transformer];
+}
+
+- (void)mapRemoteField:(NSString *)field toLocalProperty:(NSString *)property forClass:(Class)class {
+//	id<NSCopying> key = (id<NSCopying>)class ?: [NSNull null];
+	
+	if (self.fieldToPropertyMappings[class] == nil) {
+		[(NSMutableDictionary *)_fieldToPropertyMappings setObject:[NSMutableDictionary new] forKey:(id<NSCopying>)class];
+	}
+	[(NSMutableDictionary *)self.fieldToPropertyMappings[class] setObject:property forKey:field];
+	
+	if (self.propertyToFieldMappings[class] == nil) {
+		[(NSMutableDictionary *)_propertyToFieldMappings setObject:[NSMutableDictionary new] forKey:(id<NSCopying>)class];
+	}
+	[(NSMutableDictionary *)self.propertyToFieldMappings[class] setObject:field forKey:property];
+	
+	@synchronized (self.classDescriptors) {
+		[self.classDescriptors removeAllObjects]; // mappings are inherited, so any compiled class may be affected
+	}
+}
+
+- (void)addSerializationKey:(NSString *)key forClass:(Class)class {
+	if (self.serializationKeys[class] == nil) {
+		[(NSMutableDictionary *)_serializationKeys setObject:[NSMutableSet new] forKey:(id<NSCopying>)class];
+	}
+	[(NSMutableSet *)_serializationKeys[class] addObject:key];
+	
+	@synchronized (self.classDescriptors) {
+		[self.classDescriptors removeObjectForKey:class];
+	}
+}
+
+- (void)addSerializationKeys:(NSArray *)keys forClass:(Class)class {
+	for (NSString *key in keys)
+		[self addSerializationKey:key forClass:class];
+}
+
 #pragma mark -
 
-- (void)globallyMapRemoteField:(NSString *)field toLocalProperty:(NSString *)property {
-	[self mapRemoteField:field toLocalProperty:property forClass:[NSObject class]];
+- (NSString *)propertyNameForField:(NSString *)fieldName forClass:(Class)class {
+	NSString *propertyName;
+	while (class != nil) {
+		NSDictionary *fieldToPropertyMappings = self.fieldToPropertyMappings[class];
+		if (fieldToPropertyMappings && fieldToPropertyMappings[fieldName] != nil)
+			propertyName = fieldToPropertyMappings[fieldName];
+		// should we break? does it make sense to keep going?
+		class = [class superclass];
+	}
+	return propertyName ?: fieldName;
+}
+
+- (NSString *)fieldNameForProperty:(NSString *)propertyName forClass:(Class)class {
+	NSString *fieldName;
+	while (class != nil) {
+		NSDictionary *propertyToFieldMappings = self.propertyToFieldMappings[class];
+		if (propertyToFieldMappings && propertyToFieldMappings[propertyName] != nil)
+			fieldName = propertyToFieldMappings[propertyName];
+		// should we break? does it make sense to keep going?
+		class = [class superclass];
+	}
+	return fieldName ?: propertyName;
+}
+
+- (BOOL)shouldPropertyBeSerialized:(NSString *)propertyName forClass:(Class)class {
+	NSArray* ignoreKeys = @[@"superclass", @"hash", @"debugDescription"]; // never serialize these
+	
+	if ([ignoreKeys containsObject:propertyName])
+		return NO;
+	
+	NSMutableSet *serializationKeys = self.serializationKeys[class];
+	
+	if (!serializationKeys || [serializationKeys containsObject:propertyName])
+		return YES;
+	else
+		return NO;
+}
+
+#pragma mark -
+
+- (PrestoClassDescriptor *)descriptorForClass:(Class)class {
+	if (class == nil)
+		return nil;
+	
+	@synchronized (self.classDescriptors) {
+		PrestoClassDescriptor *descriptor = self.classDescriptors[class];
+		if (descriptor == nil) {
+			descriptor = [PrestoClassDescriptor descriptorForClass:class manager:self];
+			self.classDescriptors[(id<NSCopying>)class] = descriptor;
+		}
+		
+		return descriptor;
+	}
+}
+
+#pragma mark - Scheduling
+
+// all refreshes and retries share one timer, armed for the earliest due source; state is guarded by scheduledRefreshes
+
+- (void)scheduleRefreshOf:(PrestoMetadata *)metadata interval:(NSTimeInterval)interval {
+	if (!metadata)
+		return;
+	
+	BOOL never = interval == INFINITY || interval <= 0; // both 0 and INFINITY mean never
+	
+	@synchronized (self.scheduledRefreshes) {
+		PrestoScheduledRefresh *entry = [self.scheduledRefreshes objectForKey:metadata];
+		if (never) {
+			if (entry.isRetry)
+				entry.interval = 0;
+			else
+				[self.scheduledRefreshes removeObjectForKey:metadata];
+		} else {
+			if (!entry) {
+				entry = [PrestoScheduledRefresh new];
+				[self.scheduledRefreshes setObject:entry forKey:metadata];
+			}
+			entry.interval = interval;
+			if (!entry.isRetry)
+				entry.dueTime = [NSDate timeIntervalSinceReferenceDate] + [self jitteredDelay:interval];
+		}
+		[self armRefreshTimer];
+	}
+}
+
+- (void)scheduleRetryOf:(PrestoMetadata *)metadata {
+	if (!metadata)
+		return;
+	
+	@synchronized (self.scheduledRefreshes) {
+		PrestoScheduledRefresh *entry = [self.scheduledRefreshes objectForKey:metadata];
+		if (!entry) {
+			entry = [PrestoScheduledRefresh new];
+			[self.scheduledRefreshes setObject:entry forKey:metadata];
+		}
+		entry.isRetry = YES;
+		entry.dueTime = [NSDate timeIntervalSinceReferenceDate] + [self jitteredDelay:[self backoffDelay:PrestoRetryDelay failures:entry.failures++]];
+		[self armRefreshTimer];
+	}
+}
+
+- (void)cancelRetryOf:(PrestoMetadata *)metadata {
+	@synchronized (self.scheduledRefreshes) {
+		PrestoScheduledRefresh *entry = [self.scheduledRefreshes objectForKey:metadata];
+		if (!entry.isRetry)
+			return;
+		
+		entry.isRetry = NO;
+		if (entry.interval > 0)
+			entry.dueTime = [NSDate timeIntervalSinceReferenceDate] + [self jitteredDelay:[self backoffDelay:entry.interval failures:entry.failures]];
+		else
+			[self.scheduledRefreshes removeObjectForKey:metadata];
+		[self armRefreshTimer];
+	}
+}
+
+- (void)recordLoadOf:(PrestoMetadata *)metadata succeeded:(BOOL)succeeded {
+	@synchronized (self.scheduledRefreshes) {
+		PrestoScheduledRefresh *entry = [self.scheduledRefreshes objectForKey:metadata];
+		if (succeeded)
+			entry.failures = 0;
+		else
+			entry.failures++;
+	}
+}
+
+- (void)pauseRefreshing {
+	@synchronized (self.scheduledRefreshes) {
+		self.isRefreshPaused = YES;
+		self.isPausedForBackground = NO; // the app wants it paused, so coming back to the foreground mustn't resume it
+		[self armRefreshTimer];
+	}
+}
+
+- (void)resumeRefreshing {
+	@synchronized (self.scheduledRefreshes) {
+		self.isPausedForBackground = NO;
+		if (!self.isRefreshPaused)
+			return;
+		
+		self.isRefreshPaused = NO;
+		
+		// spread out everything that fell due while we were paused so it doesn't all go out in the same tick
+		NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+		for (PrestoMetadata *metadata in self.scheduledRefreshes) {
+			PrestoScheduledRefresh *entry = [self.scheduledRefreshes objectForKey:metadata];
+			if (entry.dueTime < now)
+				entry.dueTime = now + self.refreshTolerance + (entry.interval ?: PrestoRetryDelay) * self.refreshJitter * arc4random_uniform(1001) / 1000.0;
+		}
+		[self armRefreshTimer];
+	}
+}
+
+- (void)applicationDidEnterBackground:(NSNotification *)notification {
+	if (!self.pausesRefreshingInBackground)
+		return;
+	
+	@synchronized (self.scheduledRefreshes) {
+		if (self.isRefreshPaused)
+			return; // already paused by the app
+		[self pauseRefreshing];
+		self.isPausedForBackground = YES;
+	}
+}
+
+- (void)applicationWillEnterForeground:(NSNotification *)notification {
+	@synchronized (self.scheduledRefreshes) {
+		if (self.isPausedForBackground)
+			[self resumeRefreshing];
+	}
+}
+
+- (NSUInteger)scheduledRefreshCount {
+	@synchronized (self.scheduledRefreshes) {
+		return self.scheduledRefreshes.keyEnumerator.allObjects.count; // count may include entries whose metadata has gone away
+	}
+}
+
+- (NSDate *)nextRefreshDate {
+	@synchronized (self.scheduledRefreshes) {
+		NSTimeInterval dueTime = [self earliestDueTime];
+		return self.isRefreshPaused || dueTime == INFINITY ? nil : [NSDate dateWithTimeIntervalSinceReferenceDate:dueTime];
+	}
+}
+
+- (NSTimeInterval)backoffDelay:(NSTimeInterval)delay failures:(NSUInteger)failures {
+	NSTimeInterval cap = MAX(delay, self.maxBackoffInterval);
+	return MIN(delay * pow(2, MIN(failures, 16)), cap);
+}
+
+- (NSTimeInterval)jitteredDelay:(NSTimeInterval)delay {
+	double factor = 1 + self.refreshJitter * (arc4random_uniform(2001) / 1000.0 - 1); // 1 ± jitter
+	return delay * factor;
+}
+
+- (NSTimeInterval)earliestDueTime {
+	NSTimeInterval dueTime = INFINITY;
+	for (PrestoMetadata *metadata in self.scheduledRefreshes)
+		dueTime = MIN(dueTime, [self.scheduledRefreshes objectForKey:metadata].dueTime);
+	return dueTime;
+}
+
+- (void)armRefreshTimer {
+	if (!self.refreshTimer) {
+		__weak typeof(self) weakSelf = self;
+		self.refreshTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0));
+		dispatch_source_set_event_handler(self.refreshTimer, ^{
+			[weakSelf refreshTick];
+		});
+		dispatch_source_set_timer(self.refreshTimer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+		dispatch_resume(self.refreshTimer);
+	}
+	
+	NSTimeInterval dueTime = [self earliestDueTime];
+	if (self.isRefreshPaused || dueTime == INFINITY) {
+		dispatch_source_set_timer(self.refreshTimer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+		return;
+	}
+	
+	NSTimeInterval delay = MAX(dueTime - [NSDate timeIntervalSinceReferenceDate], 0);
+	dispatch_source_set_timer(self.refreshTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), DISPATCH_TIME_FOREVER, (uint64_t)(self.refreshTolerance * NSEC_PER_SEC));
+}
+
+- (void)refreshTick {
+	NSMutableArray *refreshes = [NSMutableArray new];
+	NSMutableArray *retries = [NSMutableArray new];
+	
+	@synchronized (self.scheduledRefreshes) {
+		if (self.isRefreshPaused)
+			return;
+		
+		// anything falling due within the tolerance goes out with this tick rather than waking us again shortly
+		NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+		NSTimeInterval horizon = now + self.refreshTolerance;
+		
+		for (PrestoMetadata *metadata in self.scheduledRefreshes.keyEnumerator.allObjects) {
+			PrestoScheduledRefresh *entry = [self.scheduledRefreshes objectForKey:metadata];
+			if (entry.dueTime > horizon)
+				continue;
+			
+			[(entry.isRetry ? retries : refreshes) addObject:metadata];
+			entry.isRetry = NO;
+			
+			if (entry.interval > 0)
+				entry.dueTime = now + [self jitteredDelay:[self backoffDelay:entry.interval failures:entry.failures]];
+			else
+				[self.scheduledRefreshes removeObjectForKey:metadata];
+		}
+		
+		[self armRefreshTimer];
+	}
+	
+	if (!refreshes.count && !retries.count)
+		return;
+	
+	if (LOG_VERBOSE)
+		PRLog(@"Presto: Refresh tick (%d refreshes, %d retries).", (int)refreshes.count, (int)retries.count);
+	
+	dispatch_async(self.targetQueue, ^{
+		for (PrestoMetadata *metadata in retries) {
+			if (metadata.target)
+				[metadata load:YES];
+		}
+		
+		for (PrestoMetadata *metadata in refreshes) {
+			if (!metadata.target) {
+				[self scheduleRefreshOf:metadata interval:0]; // nothing left to refresh
+				continue;
+			}
+			if (![metadata hasLiveDependents]) {
+				if (LOG_ZOMBIES)
+					PRLog(@"Presto: Skipping refresh of %@; everything depending on it has disappeared.", metadata.source.url.absoluteString);
+				continue;
+			}
+			[metadata reload];
+		}
+	});
+}
+
+#pragma mark - Requests
+
+// requests wait in a queue ordered by priority and start as slots free up (see maxConcurrentRequests)
+// equivalent GETs (same URL and headers after transformation) share a single request; the response is handed to every waiting handler
+- (void)performRequest:(NSURLRequest *)request forMetadata:(PrestoMetadata *)metadata completion:(PrestoResponseHandler)completion {
+	NSString *key = [self inFlightKeyForRequest:request];
+	
+	@synchronized (self.pendingRequests) {
+		PrestoQueuedRequest *existing = key ? self.inFlightRequests[key] : nil;
+		if (existing && !existing.isCancelled) { // a cancelled one only lingers until its task reports back
+			if (LOG_VERBOSE)
+				PRLog(@"Presto: Attaching to in-flight request %@.", request.URL.absoluteString);
+			[existing.handlers addObject:completion];
+			if (metadata)
+				[existing.metadatas addObject:metadata];
+			if (metadata.priority > existing.priority)
+				[self reprioritizeRequest:existing priority:metadata.priority];
+			self.coalescedRequests++;
+			return;
+		}
+		
+		PrestoQueuedRequest *queued = [PrestoQueuedRequest new];
+		queued.request = request;
+		queued.key = key;
+		queued.handlers = [NSMutableArray arrayWithObject:completion];
+		[self enqueueRequest:queued forMetadata:metadata];
+	}
+	
+	[self startQueuedRequests];
+}
+
+// returns nil for requests that must not be shared (anything other than a body-less GET)
+- (NSString *)inFlightKeyForRequest:(NSURLRequest *)request {
+	if (![request.HTTPMethod ?: @"GET" isEqualToString:@"GET"] || request.HTTPBody.length || !request.URL)
+		return nil;
+	
+	NSMutableString *key = [NSMutableString stringWithString:request.URL.absoluteString];
+	NSDictionary *headers = request.allHTTPHeaderFields;
+	for (NSString *field in [headers.allKeys sortedArrayUsingSelector:@selector(compare:)])
+		[key appendFormat:@"\n%@: %@", field, headers[field]];
+	
+	return key;
+}
+
+- (NSURLSession *)session {
+	@synchronized (self) {
+		if (_session == nil)
+			_session = [NSURLSession sessionWithConfiguration:self.sessionConfiguration ?: [NSURLSessionConfiguration defaultSessionConfiguration] delegate:self delegateQueue:nil];
+		return _session;
+	}
+}
+
+- (void)setSessionConfiguration:(NSURLSessionConfiguration *)sessionConfiguration {
+	@synchronized (self) {
+		_sessionConfiguration = [sessionConfiguration copy];
+		[_session finishTasksAndInvalidate]; // requests already running are left to finish on the old session
+		_session = nil;
+	}
+}
+
+- (NSInteger)queuedRequests {
+	@synchronized (self.pendingRequests) {
+		return self.pendingRequests.count;
+	}
+}
+
+#pragma mark -
+
+// call with pendingRequests locked
+- (void)enqueueRequest:(PrestoQueuedRequest *)queued forMetadata:(PrestoMetadata *)metadata {
+	queued.metadatas = [NSHashTable weakObjectsHashTable];
+	if (metadata)
+		[queued.metadatas addObject:metadata];
+	queued.priority = metadata ? metadata.priority : NSURLSessionTaskPriorityDefault;
+	queued.sequence = self.requestSequence++;
+	queued.enqueuedTime = [NSDate timeIntervalSinceReferenceDate];
+	
+	if (queued.key)
+		self.inFlightRequests[queued.key] = queued;
+	[self insertPendingRequest:queued];
+	
+	[self observeTargetOf:metadata];
+}
+
+// call with pendingRequests locked
+- (void)insertPendingRequest:(PrestoQueuedRequest *)queued {
+	NSUInteger index = self.pendingRequests.count;
+	while (index > 0 && ((PrestoQueuedRequest *)self.pendingRequests[index - 1]).priority < queued.priority)
+		index--;
+	[self.pendingRequests insertObject:queued atIndex:index];
+}
+
+// call with pendingRequests locked
+- (void)reprioritizeRequest:(PrestoQueuedRequest *)queued priority:(float)priority {
+	queued.priority = priority;
+	queued.task.priority = priority;
+	
+	NSUInteger index = [self.pendingRequests indexOfObjectIdenticalTo:queued];
+	if (index != NSNotFound) {
+		[self.pendingRequests removeObjectAtIndex:index];
+		[self insertPendingRequest:queued];
+	}
+}
+
+- (void)startQueuedRequests {
+	NSMutableArray *starting = [NSMutableArray new];
+	
+	@synchronized (self.pendingRequests) {
+		while (self.pendingRequests.count && (self.maxConcurrentRequests <= 0 || (NSInteger)self.runningRequests.count < self.maxConcurrentRequests)) {
+			PrestoQueuedRequest *queued = self.pendingRequests.firstObject;
+			[self.pendingRequests removeObjectAtIndex:0];
+			[self.runningRequests addObject:queued];
+			[starting addObject:queued];
+		}
+	}
+	
+	for (PrestoQueuedRequest *queued in starting)
+		[self startRequest:queued];
+}
+
+- (void)startRequest:(PrestoQueuedRequest *)queued {
+	NSURLSessionDataTask *task;
+	
+	if (queued.streamingTask) {
+		task = [self.session dataTaskWithRequest:queued.request];
+		@synchronized (self.streamingTasks) {
+			self.streamingTasks[@(task.taskIdentifier)] = queued.streamingTask;
+		}
+	} else {
+		task = [self.session dataTaskWithRequest:queued.request completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable connectionError) {
+			// buffered data is immutable, so each waiter can safely decode its own copy of the tree from it
+			[self finishRequest:queued jsonObject:nil data:data digest:nil response:response error:connectionError];
+		}];
+	}
+	task.priority = queued.priority;
+	
+	BOOL cancelled;
+	@synchronized (self.pendingRequests) {
+		queued.task = task;
+		queued.startedTime = [NSDate timeIntervalSinceReferenceDate];
+		cancelled = queued.isCancelled; // became a zombie while it was being started
+	}
+	
+	[task resume];
+	if (cancelled)
+		[task cancel];
+}
+
+- (void)finishRequest:(PrestoQueuedRequest *)queued jsonObject:(id)jsonObject data:(NSData *)data digest:(NSNumber *)digest response:(NSURLResponse *)response error:(NSError *)error {
+	NSArray *handlers;
+	NSArray *metadatas;
+	PrestoStreamingTask *streamingTask;
+	
+	@synchronized (self.pendingRequests) {
+		[self.runningRequests removeObjectIdenticalTo:queued];
+		[self.pendingRequests removeObjectIdenticalTo:queued];
+		if (queued.key && self.inFlightRequests[queued.key] == queued)
+			[self.inFlightRequests removeObjectForKey:queued.key];
+		handlers = [queued.handlers copy];
+		metadatas = self.collectsMetrics || queued.streamingTask.deferredLoads.count ? queued.metadatas.allObjects : nil;
+		streamingTask = queued.streamingTask;
+		queued.streamingTask = nil; // its completion refers back to us
+	}
+	
+	[self startQueuedRequests];
+	
+	if (metadatas.count) {
+		NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+		for (PrestoMetadata *metadata in metadatas) {
+			if (streamingTask.deferredLoads.count)
+				metadata.deferredLoads = streamingTask.deferredLoads; // streamed requests are never shared
+			
+			PrestoRequestMetrics *metrics = metadata.requestMetrics;
+			metrics.request = queued.request;
+			metrics.statusCode = [response isKindOfClass:[NSHTTPURLResponse class]] ? ((NSHTTPURLResponse *)response).statusCode : 0;
+			metrics.taskMetrics = queued.taskMetrics;
+			metrics.queueWait = (queued.startedTime ?: now) - queued.enqueuedTime;
+			metrics.network = queued.taskMetrics ? queued.taskMetrics.taskInterval.duration : queued.startedTime ? now - queued.startedTime : 0;
+			metrics.parse = streamingTask.parseTime;
+			metrics.requestBytes = queued.request.HTTPBody.length;
+			metrics.responseBytes = streamingTask ? streamingTask.receivedBytes : data.length;
+			metrics.isFinished = YES;
+		}
+	}
+	
+	for (PrestoResponseHandler handler in handlers)
+		handler(jsonObject, data, digest, response, error);
+}
+
+#pragma mark -
+
+- (void)observeTargetOf:(PrestoMetadata *)metadata {
+	[self observeDeallocationOf:metadata.target];
+}
+
+// once object is gone, requests that were only kept alive by it are cancelled
+// targets and the owners of dependencies (see onChange:forLifetimeOf:) are observed alike
+- (void)observeDeallocationOf:(id)object {
+	if (!object || objc_getAssociatedObject(object, &PrestoDeallocObserverKey))
+		return;
+	
+	__weak typeof(self) weakSelf = self;
+	PrestoDeallocObserver *observer = [PrestoDeallocObserver new];
+	observer.block = ^{
+		typeof(self) strongSelf = weakSelf;
+		dispatch_async(strongSelf.targetQueue ?: dispatch_get_main_queue(), ^{
+			[strongSelf cancelZombieRequests];
+		});
+	};
+	objc_setAssociatedObject(object, &PrestoDeallocObserverKey, observer, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+}
+
+// cancels queued and in-flight GETs that nothing is waiting on anymore
+// this runs on the target queue, since that's where the callbacks it inspects are modified
+- (void)cancelZombieRequests {
+	NSMutableArray *unstarted = [NSMutableArray new];
+	NSMutableArray *tasks = [NSMutableArray new];
+	
+	@synchronized (self.pendingRequests) {
+		for (PrestoQueuedRequest *queued in [self.pendingRequests arrayByAddingObjectsFromArray:self.runningRequests]) {
+			if (queued.isCancelled || ![self isZombieRequest:queued])
+				continue;
+			
+			queued.isCancelled = YES;
+			if (queued.key && self.inFlightRequests[queued.key] == queued)
+				[self.inFlightRequests removeObjectForKey:queued.key]; // so an equivalent request from someone who is waiting starts afresh
+			if (queued.task)
+				[tasks addObject:queued.task];
+			else if ([self.pendingRequests indexOfObjectIdenticalTo:queued] != NSNotFound)
+				[unstarted addObject:queued];
+			// otherwise it's being started right now, and startRequest: will cancel it
+		}
+	}
+	
+	if (LOG_ZOMBIES && (tasks.count || unstarted.count))
+		PRLog(@"Presto: Cancelling %d zombie requests.", (int)(tasks.count + unstarted.count));
+	
+	for (NSURLSessionTask *task in tasks)
+		[task cancel];
+	
+	NSError *cancelled = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil];
+	for (PrestoQueuedRequest *queued in unstarted)
+		[self finishRequest:queued jsonObject:nil data:nil digest:nil response:nil error:cancelled];
+}
+
+- (BOOL)isZombieRequest:(PrestoQueuedRequest *)queued {
+	if (![queued.request.HTTPMethod ?: @"GET" isEqualToString:@"GET"])
+		return NO; // never cancel anything with side effects
+	
+	for (PrestoMetadata *metadata in queued.metadatas) {
+		if (!metadata.isZombie)
+			return NO;
+	}
+	return YES;
+}
+
+#pragma mark - Streaming
+
+- (void)streamRequest:(NSURLRequest *)request forMetadata:(PrestoMetadata *)metadata bindingClass:(Class)class atDepth:(int)depth completion:(PrestoResponseHandler)completion {
+	PrestoQueuedRequest *queued = [PrestoQueuedRequest new];
+	queued.request = request;
+	queued.handlers = [NSMutableArray arrayWithObject:completion]; // streamed requests are never shared
+	
+	PrestoStreamingTask *record = [PrestoStreamingTask new];
+	record.parser = [PrestoJSONStreamParser new];
+	record.parser.manager = self;
+	record.parser.bindClass = depth > 0 ? class : nil; // depth 0 is bound into the target by loadWithDictionary: as usual
+	record.parser.bindDepth = depth;
+	record.digest = PrestoDigestSeed;
+	record.timesParsing = self.collectsMetrics;
+	record.deferredLoads = [NSMutableArray new];
+	record.parser.context = [PrestoLoadContext contextWithMetrics:nil deferredLoads:record.deferredLoads];
+	record.completion = ^(id jsonObject, NSData *data, NSNumber *digest, NSURLResponse *response, NSError *error) {
+		[self finishRequest:queued jsonObject:jsonObject data:data digest:digest response:response error:error];
+	};
+	queued.streamingTask = record;
+	
+	@synchronized (self.pendingRequests) {
+		[self enqueueRequest:queued forMetadata:metadata];
+	}
+	
+	[self startQueuedRequests];
+}
+
+- (PrestoStreamingTask *)streamingTaskForTask:(NSURLSessionTask *)task {
+	@synchronized (self.streamingTasks) {
+		return self.streamingTasks[@(task.taskIdentifier)];
+	}
+}
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveResponse:(NSURLResponse *)response completionHandler:(void (^)(NSURLSessionResponseDisposition))completionHandler {
+	if ([response isKindOfClass:[NSHTTPURLResponse class]] && ((NSHTTPURLResponse *)response).statusCode != 200) {
+		// error bodies are small and not necessarily JSON, so keep them whole for errorResponse and lastResponseString
+		PrestoStreamingTask *record = [self streamingTaskForTask:dataTask];
+		record.parser = nil;
+		record.bufferedData = [NSMutableData new];
+	}
+	completionHandler(NSURLSessionResponseAllow);
+}
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveData:(NSData *)data {
+	PrestoStreamingTask *record = [self streamingTaskForTask:dataTask];
+	
+	[data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+		record.digest = PrestoDigestBytes(record.digest, bytes, byteRange.length);
+	}];
+	record.receivedBytes += data.length;
+	
+	if (record.bufferedData) {
+		[record.bufferedData appendData:data];
+	} else {
+		NSTimeInterval start = record.timesParsing ? [NSDate timeIntervalSinceReferenceDate] : 0;
+		[record.parser parseData:data]; // a malformed payload is reported once the task completes
+		if (record.timesParsing)
+			record.parseTime += [NSDate timeIntervalSinceReferenceDate] - start;
+	}
+}
+
+// sent for every task, streamed or not, ahead of its completion
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didFinishCollectingMetrics:(NSURLSessionTaskMetrics *)metrics {
+	if (!self.collectsMetrics)
+		return;
+	
+	@synchronized (self.pendingRequests) {
+		for (PrestoQueuedRequest *queued in self.runningRequests) {
+			if (queued.task == task) {
+				queued.taskMetrics = metrics;
+				break;
+			}
+		}
+	}
+}
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didCompleteWithError:(NSError *)error {
+	PrestoStreamingTask *record;
+	@synchronized (self.streamingTasks) {
+		record = self.streamingTasks[@(task.taskIdentifier)];
+		[self.streamingTasks removeObjectForKey:@(task.taskIdentifier)];
+	}
+	
+	NSTimeInterval start = record.timesParsing ? [NSDate timeIntervalSinceReferenceDate] : 0;
+	id jsonObject = error ? nil : [record.parser finish];
+	if (record.timesParsing)
+		record.parseTime += [NSDate timeIntervalSinceReferenceDate] - start;
+	if (!error && record.parser.error)
+		error = record.parser.error;
+	
+	if (record.completion)
+		record.completion(jsonObject, record.bufferedData, @(record.digest), task.response, error);
+}
+
+#pragma mark -
+
+- (void)warnProperty:(NSString *)propertyName forClass:(Class)class valueClass:(Class)valueClass {
+	if (!LOG_WARNINGS)
+		return;
+	
+	@synchronized (self.warnedKeys) {
+		if (self.warnedKeys[class] == nil) {
+			self.warnedKeys[(id<NSCopying>)class] = [NSMutableSet new];
+		}
+		
+		if ([self.warnedKeys[class] containsObject:propertyName])
+			return;
+		[self.warnedKeys[class] addObject:propertyName];
+	}
+	
+	PRLog(@"pRESTo Warning: Property ‘%@’ (%@) not found in class %@.", propertyName, valueClass, class);
+}
+
+@end
+
+#pragma mark - PrestoPropertyDescriptor
+
+// these call the resolved accessor IMPs directly with the correct C signature
+#define PRGetScalar(TYPE) ((TYPE (*)(id, SEL))self.getterIMP)(target, self.getter)
+#define PRSetScalar(TYPE, VALUE) ((void (*)(id, SEL, TYPE))self.setterIMP)(target, self.setter, (TYPE)(VALUE))
+
+@implementation PrestoPropertyDescriptor
+
++ (instancetype)descriptorForProperty:(objc_property_t)property ofClass:(Class)class {
+	PrestoPropertyDescriptor *descriptor = [PrestoPropertyDescriptor new];
+	descriptor.ownerClass = class;
+	descriptor.name = [NSString stringWithUTF8String:property_getName(property)];
+	
+	NSString *type = @"";
+	NSString *getterName, *setterName;
+	
+	uint count;
+	objc_property_attribute_t *attributes = property_copyAttributeList(property, &count);
+	for (int i = 0; i < count; i++) {
+		switch (attributes[i].name[0]) {
+			case 'T': type = [NSString stringWithUTF8String:attributes[i].value]; break;
+			case 'R': descriptor.isReadOnly = YES; break;
+			case 'W': descriptor.isWeak = YES; break;
+			case 'G': getterName = [NSString stringWithUTF8String:attributes[i].value]; break;
+			case 'S': setterName = [NSString stringWithUTF8String:attributes[i].value]; break;
+		}
+	}
+	free(attributes);
+	
+	descriptor.typeEncoding = type.length ? (char)[type characterAtIndex:0] : 0;
+	descriptor.isBool = [type isEqualToString:[NSString stringWithUTF8String:@encode(BOOL)]];
+	
+	// object types look like @"NSArray<MyClass><DoNotSerialize>"
+	if (descriptor.typeEncoding == '@' && type.length > 3) {
+		NSString *typeName = [type substringWithRange:NSMakeRange(2, type.length - 3)];
+		long protocolIndex = [typeName rangeOfString:@"<"].location; // 0 for id<...>, which carries no class
+		if (protocolIndex != 0 && protocolIndex != NSNotFound) {
+			NSString *protocolName = [typeName substringWithRange:NSMakeRange(protocolIndex + 1, [typeName rangeOfString:@">" options:NSBackwardsSearch].location - protocolIndex - 1)];
+			NSArray *protocolNames = [protocolName componentsSeparatedByString:@"><"];
+			descriptor.doNotSerialize = [protocolNames containsObject:@"DoNotSerialize"];
+			
+			for (NSString *name in protocolNames) {
+				if ([@[@"Identifying", @"SortKey", @"DoNotSerialize"] containsObject:name])
+					continue; // attribute protocols don't name an element class
+				descriptor.protocolClass = NSClassFromString(name);
+				if (descriptor.protocolClass == nil && LOG_WARNINGS)
+					PRLog(@"pRESTo Warning: protocolClass not determinable from protocol name ‘%@’.", name);
+				break;
+			}
+			typeName = [typeName substringToIndex:protocolIndex];
+		}
+		descriptor.propertyClass = NSClassFromString(typeName);
+	}
+	
+	descriptor.getter = NSSelectorFromString(getterName ?: descriptor.name);
+	descriptor.getterIMP = method_getImplementation(class_getInstanceMethod(class, descriptor.getter));
+	
+	if (!descriptor.isReadOnly) {
+		if (!setterName && descriptor.name.length)
+			setterName = [NSString stringWithFormat:@"set%@%@:", [[descriptor.name substringToIndex:1] uppercaseString], [descriptor.name substringFromIndex:1]];
+		descriptor.setter = NSSelectorFromString(setterName);
+		descriptor.setterIMP = method_getImplementation(class_getInstanceMethod(class, descriptor.setter));
+	}
+	
+	return descriptor;
+}
+
+// KVO-swizzled instances, @dynamic properties and struct types all fall back to KVC
+- (id)valueForTarget:(id)target {
+	if (!self.getterIMP || object_getClass(target) != self.ownerClass)
+		return [target valueForKey:self.name];
+	
+	switch (self.typeEncoding) {
+		case '@': return ((id (*)(id, SEL))self.getterIMP)(target, self.getter);
+		case 'c': return self.isBool ? @(PRGetScalar(BOOL)) : @(PRGetScalar(char));
+		case 'B': return @(PRGetScalar(bool));
+		case 'C': return @(PRGetScalar(unsigned char));
+		case 's': return @(PRGetScalar(short));
+		case 'S': return @(PRGetScalar(unsigned short));
+		case 'i': return @(PRGetScalar(int));
+		case 'I': return @(PRGetScalar(unsigned int));
+		case 'l': return @(PRGetScalar(long));
+		case 'L': return @(PRGetScalar(unsigned long));
+		case 'q': return @(PRGetScalar(long long));
+		case 'Q': return @(PRGetScalar(unsigned long long));
+		case 'f': return @(PRGetScalar(float));
+		case 'd': return @(PRGetScalar(double));
+		default: return [target valueForKey:self.name];
+	}
+}
+
+- (void)setValue:(id)value forTarget:(id)target {
+	if (!self.setterIMP || object_getClass(target) != self.ownerClass) {
+		[target setValue:value forKey:self.name];
+		return;
+	}
+	
+	if (self.typeEncoding == '@') {
+		PRSetScalar(id, value);
+		return;
+	}
+	
+	// KVC raises on nil or non-numeric values for scalars, which callers rely on to report the failure, so let it handle those
+	if (![value respondsToSelector:@selector(longLongValue)] || ![value respondsToSelector:@selector(doubleValue)]) {
+		[target setValue:value forKey:self.name];
+		return;
+	}
+	
+	switch (self.typeEncoding) {
+		case 'c':
+			if (self.isBool)
+				PRSetScalar(BOOL, [value boolValue]);
+			else
+				PRSetScalar(char, [value longLongValue]);
+			break;
+		case 'B': PRSetScalar(bool, [value boolValue]); break;
+		case 'C': PRSetScalar(unsigned char, [value longLongValue]); break;
+		case 's': PRSetScalar(short, [value longLongValue]); break;
+		case 'S': PRSetScalar(unsigned short, [value longLongValue]); break;
+		case 'i': PRSetScalar(int, [value longLongValue]); break;
+		case 'I': PRSetScalar(unsigned int, [value longLongValue]); break;
+		case 'l': PRSetScalar(long, [value longLongValue]); break;
+		case 'L': PRSetScalar(unsigned long, [value longLongValue]); break;
+		case 'q': PRSetScalar(long long, [value longLongValue]); break;
+		case 'Q': PRSetScalar(unsigned long long, [value longLongValue]); break;
+		case 'f': PRSetScalar(float, [value doubleValue]); break;
+		case 'd': PRSetScalar(double, [value doubleValue]); break;
+		default: [target setValue:value forKey:self.name]; break;
+	}
+}
+
+@end
+
+#undef PRGetScalar
+#undef PRSetScalar
+
+#pragma mark - PrestoClassDescriptor
+
+@implementation PrestoClassDescriptor
+
++ (instancetype)descriptorForClass:(Class)class manager:(Presto *)manager {
+	PrestoClassDescriptor *descriptor = [PrestoClassDescriptor new];
+	descriptor.describedClass = class;
+	
+	NSMutableDictionary *properties = [NSMutableDictionary new];
+	NSMutableArray *serializableProperties = [NSMutableArray new];
+	
+	for (Class current = class; current && current != [NSObject class]; current = [current superclass]) {
+		uint count;
+		objc_property_t *c_properties = class_copyPropertyList(current, &count);
+		for (int i = 0; i < count; i++) {
+			NSString *name = [NSString stringWithUTF8String:property_getName(c_properties[i])];
+			if (properties[name] || [name isEqualToString:@"presto"])
+				continue; // a redeclaration in a subclass wins
+			
+			PrestoPropertyDescriptor *property = [PrestoPropertyDescriptor descriptorForProperty:c_properties[i] ofClass:class];
+			property.fieldName = [manager fieldNameForProperty:name forClass:class];
+			property.isSerialized = !property.isWeak && !property.isReadOnly && !property.doNotSerialize && [manager shouldPropertyBeSerialized:name forClass:class];
+			
+			properties[name] = property;
+			if (property.isSerialized)
+				[serializableProperties addObject:property];
+		}
+		free(c_properties);
+	}
+	
+	// unmapped fields load the property of the same name; mappings are applied subclass first so the same mapping wins as in propertyNameForField:forClass:
+	NSMutableDictionary *fields = [properties mutableCopy];
+	for (Class current = class; current != nil; current = [current superclass]) {
+		[(NSDictionary *)manager.fieldToPropertyMappings[current] enumerateKeysAndObjectsUsingBlock:^(NSString *field, NSString *propertyName, BOOL *stop) {
+			fields[field] = properties[propertyName] ?: [NSNull null];
+		}];
+	}
+	
+	descriptor.properties = properties;
+	descriptor.fields = fields;
+	descriptor.serializableProperties = serializableProperties;
+	
+	return descriptor;
+}
+
+- (PrestoPropertyDescriptor *)propertyForField:(NSString *)field {
+	PrestoPropertyDescriptor *property = self.fields[field];
+	return property == (id)[NSNull null] ? nil : property;
+}
+
+@end
+
+#pragma mark - PrestoJSONStreamParser
+
+static BOOL PrestoScanHex(const uint8_t *bytes, NSUInteger length, uint32_t *result) {
+	if (length < 4)
+		return NO;
+	
+	uint32_t value = 0;
+	for (int i = 0; i < 4; i++) {
+		uint8_t c = bytes[i];
+		value <<= 4;
+		if (c >= '0' && c <= '9')
+			value |= c - '0';
+		else if (c >= 'a' && c <= 'f')
+			value |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			value |= c - 'A' + 10;
+		else
+			return NO;
+	}
+	*result = value;
+	return YES;
+}
+
+static void PrestoAppendUTF8(NSMutableData *data, uint32_t codePoint) {
+	uint8_t bytes[4];
+	NSUInteger length;
+	
+	if (codePoint >= 0xD800 && codePoint <= 0xDFFF)
+		codePoint = 0xFFFD; // unpaired surrogate
+	
+	if (codePoint < 0x80) {
+		bytes[0] = codePoint;
+		length = 1;
+	} else if (codePoint < 0x800) {
+		bytes[0] = 0xC0 | (codePoint >> 6);
+		bytes[1] = 0x80 | (codePoint & 0x3F);
+		length = 2;
+	} else if (codePoint < 0x10000) {
+		bytes[0] = 0xE0 | (codePoint >> 12);
+		bytes[1] = 0x80 | ((codePoint >> 6) & 0x3F);
+		bytes[2] = 0x80 | (codePoint & 0x3F);
+		length = 3;
+	} else {
+		bytes[0] = 0xF0 | (codePoint >> 18);
+		bytes[1] = 0x80 | ((codePoint >> 12) & 0x3F);
+		bytes[2] = 0x80 | ((codePoint >> 6) & 0x3F);
+		bytes[3] = 0x80 | (codePoint & 0x3F);
+		length = 4;
+	}
+	[data appendBytes:bytes length:length];
+}
+
+@interface PrestoJSONStreamParser ()
+
+@property (strong, nonatomic) NSMutableArray *containers;	// the currently open arrays and dictionaries, innermost last
+@property (strong, nonatomic) NSMutableArray *keys;		// the pending key for each open container (NSNull for arrays)
+@property (strong, nonatomic) NSMutableData *pending;		// the start of a token that was split across chunks
+@property (nonatomic) NSUInteger scanned;				// how far into pending the end of that token has been looked for already
+@property (nonatomic) BOOL scannedEscape;				// whether the part of a string scanned so far had any escapes
+@property (strong, nonatomic) id root;
+@property (nonatomic) PrestoJSONState state;
+@property (nonatomic) BOOL receivedData;
+
+@end
+
+@implementation PrestoJSONStreamParser
+
+- (instancetype)init {
+	self = [super init];
+	if (self) {
+		self.containers = [NSMutableArray new];
+		self.keys = [NSMutableArray new];
+		self.state = PrestoJSONExpectValue;
+	}
+	return self;
+}
+
+- (BOOL)parseData:(NSData *)data {
+	return [self parseData:data final:NO];
+}
+
+- (id)finish {
+	if (![self parseData:nil final:YES])
+		return nil;
+	
+	if (!self.receivedData)
+		return nil; // empty body
+	
+	if (self.state != PrestoJSONExpectNothing) {
+		[self failWithReason:@"Unexpected end of JSON payload."];
+		return nil;
+	}
+	
+	return self.root;
+}
+
+- (BOOL)parseData:(NSData *)data final:(BOOL)final {
+	if (self.error)
+		return NO;
+	
+	NSData *buffer = data ?: [NSData data];
+	NSMutableData *pending = self.pending;
+	self.pending = nil;
+	if (pending.length) {
+		[pending appendData:buffer];
+		buffer = pending;
+	}
+	
+	const uint8_t *bytes = buffer.bytes;
+	NSUInteger length = buffer.length;
+	NSUInteger i = 0;
+	
+	while (i < length) {
+		uint8_t c = bytes[i];
+		if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+			i++;
+			continue;
+		}
+		self.receivedData = YES;
+		
+		NSUInteger consumed = [self parseToken:bytes + i length:length - i final:final];
+		if (self.error)
+			return NO;
+		if (consumed == 0)
+			break; // the token continues in the next chunk
+		i += consumed;
+	}
+	
+	if (i < length) {
+		if (final)
+			return [self failWithReason:@"Unexpected end of JSON payload."];
+		// if the token was already pending, it's extended in place by the next chunk rather than copied again
+		self.pending = buffer == pending && i == 0 ? pending : [NSMutableData dataWithBytes:bytes + i length:length - i];
+	}
+	
+	return YES;
+}
+
+// returns the number of bytes consumed, or 0 if the token is incomplete (or invalid, in which case error is set)
+- (NSUInteger)parseToken:(const uint8_t *)bytes length:(NSUInteger)length final:(BOOL)final {
+	uint8_t c = bytes[0];
+	PrestoJSONState state = self.state;
+	BOOL expectsValue = state == PrestoJSONExpectValue || state == PrestoJSONExpectValueOrEnd;
+	BOOL expectsKey = state == PrestoJSONExpectKey || state == PrestoJSONExpectKeyOrEnd;
+	
+	switch (c) {
+		case '{':
+		case '[':
+			if (!expectsValue)
+				return [self failWithUnexpectedCharacter:c];
+			[self.containers addObject:c == '{' ? [NSMutableDictionary new] : [NSMutableArray new]];
+			[self.keys addObject:[NSNull null]];
+			self.state = c == '{' ? PrestoJSONExpectKeyOrEnd : PrestoJSONExpectValueOrEnd;
+			return 1;
+			
+		case '}':
+		case ']': {
+			id container = self.containers.lastObject;
+			BOOL isDictionary = [container isKindOfClass:[NSDictionary class]];
+			BOOL allowed = c == '}'
+				? isDictionary && (state == PrestoJSONExpectKeyOrEnd || state == PrestoJSONExpectCommaOrEnd)
+				: container && !isDictionary && (state == PrestoJSONExpectValueOrEnd || state == PrestoJSONExpectCommaOrEnd);
+			if (!allowed)
+				return [self failWithUnexpectedCharacter:c];
+			[self.containers removeLastObject];
+			[self.keys removeLastObject];
+			[self emitValue:[self bindContainer:container]];
+			return 1;
+		}
+			
+		case ',':
+			if (state != PrestoJSONExpectCommaOrEnd)
+				return [self failWithUnexpectedCharacter:c];
+			self.state = [self.containers.lastObject isKindOfClass:[NSDictionary class]] ? PrestoJSONExpectKey : PrestoJSONExpectValue;
+			return 1;
+			
+		case ':':
+			if (state != PrestoJSONExpectColon)
+				return [self failWithUnexpectedCharacter:c];
+			self.state = PrestoJSONExpectValue;
+			return 1;
+			
+		case '"': {
+			if (!expectsValue && !expectsKey)
+				return [self failWithUnexpectedCharacter:c];
+			NSUInteger consumed = 0;
+			NSString *string = [self scanString:bytes length:length consumed:&consumed];
+			if (string == nil)
+				return 0;
+			if (expectsKey) {
+				self.keys[self.keys.count - 1] = string;
+				self.state = PrestoJSONExpectColon;
+			} else
+				[self emitValue:string];
+			return consumed;
+		}
+			
+		default:
+			if (!expectsValue)
+				return [self failWithUnexpectedCharacter:c];
+			return [self scanLiteral:bytes length:length final:final];
+	}
+}
+
+- (void)emitValue:(id)value {
+	id container = self.containers.lastObject;
+	
+	if (container == nil) {
+		self.root = value;
+		self.state = PrestoJSONExpectNothing;
+		return;
+	}
+	
+	if ([container isKindOfClass:[NSDictionary class]])
+		[(NSMutableDictionary *)container setObject:value forKey:self.keys.lastObject];
+	else
+		[(NSMutableArray *)container addObject:value];
+	self.state = PrestoJSONExpectCommaOrEnd;
+}
+
+- (id)bindContainer:(id)container {
+	// a container's depth is the number of containers still open around it, matching processJSONObject:forClass:depth:context:
+	if (self.bindClass == nil || self.containers.count != self.bindDepth)
+		return container;
+	
+	if (![container isKindOfClass:[NSDictionary class]]) {
+		if (LOG_WARNINGS)
+			PRLog(@"pRESTo Warning: Supplied class depth does not correspond to a dictionary in the response. Actual type: %@", [container class]);
+		return container;
+	}
+	
+	// note: the element is still collected into a dictionary first and walked again by loadWithDictionary:
+	// identity lookup (identifyingKeyForDictionary:), objectWillLoad:, field mappings and the subtree digest are all defined on the whole dictionary, so the tokens can't be bound straight into properties without giving those up
+	// what streaming saves is holding the whole payload (and the whole tree) at once, not the per-element dictionary
+	return [self.manager instantiateClass:self.bindClass withDictionary:container context:self.context] ?: container;
+}
+
+// picks up where the last chunk left off, so a string split across many chunks is still only scanned once
+- (NSString *)scanString:(const uint8_t *)bytes length:(NSUInteger)length consumed:(NSUInteger *)consumed {
+	BOOL escaped = self.scannedEscape;
+	NSUInteger end = MAX(self.scanned, 1);
+	
+	while (end < length && bytes[end] != '"') {
+		if (bytes[end] == '\\') {
+			if (end + 1 >= length)
+				break; // the escaped character hasn't arrived yet either
+			escaped = YES;
+			end++;
+		}
+		end++;
+	}
+	
+	if (end >= length || bytes[end] != '"') {
+		self.scanned = end; // the closing quote hasn't arrived yet
+		self.scannedEscape = escaped;
+		return nil;
+	}
+	
+	self.scanned = 0;
+	self.scannedEscape = NO;
+	*consumed = end + 1;
+	
+	NSString *string = escaped ? [self unescapeString:bytes + 1 length:end - 1] : [[NSString alloc] initWithBytes:bytes + 1 length:end - 1 encoding:NSUTF8StringEncoding];
+	if (string == nil && !self.error)
+		[self failWithReason:@"Invalid UTF-8 in JSON string."];
+	
+	return string;
+}
+
+- (NSString *)unescapeString:(const uint8_t *)bytes length:(NSUInteger)length {
+	NSMutableData *output = [NSMutableData dataWithCapacity:length];
+	NSUInteger i = 0;
+	
+	while (i < length) {
+		NSUInteger run = i;
+		while (i < length && bytes[i] != '\\')
+			i++;
+		[output appendBytes:bytes + run length:i - run];
+		if (i >= length)
+			break;
+		
+		uint8_t escape = bytes[i + 1]; // scanString: guarantees a byte follows every backslash
+		uint8_t c;
+		i += 2;
+		
+		switch (escape) {
+			case '"': case '\\': case '/': c = escape; break;
+			case 'b': c = '\b'; break;
+			case 'f': c = '\f'; break;
+			case 'n': c = '\n'; break;
+			case 'r': c = '\r'; break;
+			case 't': c = '\t'; break;
+			case 'u': {
+				uint32_t codePoint, low;
+				if (!PrestoScanHex(bytes + i, length - i, &codePoint)) {
+					[self failWithReason:@"Invalid \\u escape in JSON string."];
+					return nil;
+				}
+				i += 4;
+				if (codePoint >= 0xD800 && codePoint <= 0xDBFF && i + 6 <= length && bytes[i] == '\\' && bytes[i + 1] == 'u'
+						&& PrestoScanHex(bytes + i + 2, 4, &low) && low >= 0xDC00 && low <= 0xDFFF) {
+					codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+					i += 6;
+				}
+				PrestoAppendUTF8(output, codePoint);
+				continue;
+			}
+			default:
+				[self failWithReason:[NSString stringWithFormat:@"Invalid escape ‘\\%c’ in JSON string.", escape]];
+				return nil;
+		}
+		[output appendBytes:&c length:1];
+	}
+	
+	return [[NSString alloc] initWithData:output encoding:NSUTF8StringEncoding];
+}
+
+// numbers, true, false and null
+- (NSUInteger)scanLiteral:(const uint8_t *)bytes length:(NSUInteger)length final:(BOOL)final {
+	NSUInteger end = self.scanned;
+	while (end < length && ((bytes[end] >= '0' && bytes[end] <= '9') || (bytes[end] >= 'a' && bytes[end] <= 'z') || bytes[end] == '-' || bytes[end] == '+' || bytes[end] == '.' || bytes[end] == 'E'))
+		end++;
+	
+	if (end == length && !final) {
+		self.scanned = end; // the literal may continue in the next chunk
+		return 0;
+	}
+	self.scanned = 0;
+	if (end == 0)
+		return [self failWithUnexpectedCharacter:bytes[0]];
+	
+	id value;
+	if (end == 4 && memcmp(bytes, "true", 4) == 0)
+		value = @YES;
+	else if (end == 5 && memcmp(bytes, "false", 5) == 0)
+		value = @NO;
+	else if (end == 4 && memcmp(bytes, "null", 4) == 0)
+		value = [NSNull null];
+	else if (end < 64 && (bytes[0] == '-' || (bytes[0] >= '0' && bytes[0] <= '9'))) {
+		char number[64];
+		memcpy(number, bytes, end);
+		number[end] = 0;
+		
+		char *parsedEnd;
+		BOOL integral = memchr(number, '.', end) == NULL && memchr(number, 'e', end) == NULL && memchr(number, 'E', end) == NULL;
+		if (integral) {
+			errno = 0;
+			long long integer = strtoll(number, &parsedEnd, 10);
+			value = errno == ERANGE ? @(strtod(number, &parsedEnd)) : @(integer);
+		} else
+			value = @(strtod(number, &parsedEnd));
+		
+		if (parsedEnd != number + end)
+			value = nil;
+	}
+	
+	if (value == nil)
+		return [self failWithReason:[NSString stringWithFormat:@"Invalid JSON literal ‘%@’.", [[NSString alloc] initWithBytes:bytes length:end encoding:NSUTF8StringEncoding]]];
+	
+	[self emitValue:value];
+	return end;
+}
+
+- (BOOL)failWithUnexpectedCharacter:(uint8_t)c {
+	return [self failWithReason:[NSString stringWithFormat:@"Unexpected character ‘%c’ in JSON payload.", c]];
+}
+
+- (BOOL)failWithReason:(NSString *)reason {
+	_error = [NSError errorWithDomain:@"PrestoErrorDomain" code:-1 userInfo:@{NSLocalizedDescriptionKey:reason}];
+	return NO;
+}
+
+@end
+
+#pragma mark - PrestoJSONWriter
+
+@implementation PrestoJSONWriter {
+	uint8_t *_bytes;
+	NSUInteger _length;
+	NSUInteger _capacity;
+}
+
+- (void)dealloc {
+	free(_bytes);
+}
+
+- (const uint8_t *)bytes {
+	return _bytes;
+}
+
+- (NSUInteger)length {
+	return _length;
+}
+
+- (void)reset {
+	_length = 0; // keeps the capacity for next time
+}
+
+- (NSData *)data {
+	return [NSData dataWithBytes:_bytes length:_length];
+}
+
+- (void)appendBytes:(const void *)bytes length:(NSUInteger)length {
+	if (_length + length > _capacity) {
+		_capacity = MAX(_capacity * 2, MAX(_length + length, 1024));
+		_bytes = realloc(_bytes, _capacity);
+	}
+	memcpy(_bytes + _length, bytes, length);
+	_length += length;
+}
+
+- (void)appendLiteral:(const char *)literal {
+	[self appendBytes:literal length:strlen(literal)];
+}
+
+#pragma mark -
+
+- (void)writeValue:(id)value template:(id)template {
+	if (value == nil || value == [NSNull null])
+		[self appendLiteral:"null"];
+	else if ([value isKindOfClass:[NSString class]])
+		[self writeString:value];
+	else if ([value isKindOfClass:[NSNumber class]])
+		[self writeNumber:value];
+	else if ([value isKindOfClass:[NSDictionary class]])
+		[self writeDictionary:value template:template];
+	else if ([value isKindOfClass:[NSArray class]])
+		[self writeArray:value template:template];
+	else
+		[self writeObject:value template:template];
+}
+
+- (void)writeObject:(NSObject *)object template:(id)template {
+	if ([object isKindOfClass:[NSDictionary class]] || [object isKindOfClass:[NSArray class]]) {
+		[self writeValue:object template:template];
+		return;
+	}
+	
+	// only the keys of a template are used (see withTemplate:)
+	NSSet *templateKeys;
+	if ([template isKindOfClass:[NSDictionary class]])
+		templateKeys = [NSSet setWithArray:[template allKeys]];
+	else if ([template isKindOfClass:[NSArray class]])
+		templateKeys = [NSSet setWithArray:template];
+	NSMutableSet *missingKeys = [templateKeys mutableCopy];
+	
+	// weak, read-only, DoNotSerialize and non-whitelisted properties are already filtered out of serializableProperties
+	PrestoClassDescriptor *classDescriptor = [self.manager descriptorForClass:[object class]];
+	BOOL first = YES;
+	
+	[self appendLiteral:"{"];
+	for (PrestoPropertyDescriptor *property in classDescriptor.serializableProperties) {
+		NSString *fieldName = property.fieldName;
+		if (templateKeys && ![templateKeys containsObject:fieldName])
+			continue;
+		
+		id value = [property valueForTarget:object];
+		if (value == object)
+			continue;
+		
+		NSUInteger mark = _length;
+		if (!first)
+			[self appendLiteral:","];
+		[self writeString:fieldName];
+		[self appendLiteral:":"];
+		
+		if (![self writePropertyValue:value ofProperty:property template:[template isKindOfClass:[NSDictionary class]] ? template[fieldName] : nil]) {
+			_length = mark; // take back the key
+			continue;
+		}
+		
+		first = NO;
+		[missingKeys removeObject:fieldName];
+	}
+	
+	// add null values for any missing keys
+	for (NSString *key in missingKeys) {
+		if (!first)
+			[self appendLiteral:","];
+		[self writeString:key];
+		[self appendLiteral:":null"];
+		first = NO;
+	}
+	[self appendLiteral:"}"];
+}
+
+- (BOOL)writePropertyValue:(id)value ofProperty:(PrestoPropertyDescriptor *)property template:(id)template {
+	if ([value isKindOfClass:[Presto class]] || [value isKindOfClass:[PrestoMetadata class]] || [value isKindOfClass:[PrestoSource class]])
+		return NO; // don't serialize internal objects
+	
+	// BOOL properties are serialized as "true" or "false" rather than 0 or 1
+	if (property.isBool && [value isKindOfClass:[NSNumber class]]) {
+		if ([value isEqualToNumber:@(0)])
+			value = @NO;
+		else if ([value isEqualToNumber:@(1)])
+			value = @YES;
+	}
+	
+	[self writeValue:value template:template];
+	return YES;
+}
+
+- (void)writeDictionary:(NSDictionary *)dictionary template:(id)template {
+	BOOL first = YES;
+	
+	[self appendLiteral:"{"];
+	for (id key in dictionary) {
+		if (!first)
+			[self appendLiteral:","];
+		first = NO;
+		[self writeString:[key isKindOfClass:[NSString class]] ? key : [key description]];
+		[self appendLiteral:":"];
+		[self writeValue:dictionary[key] template:[template isKindOfClass:[NSDictionary class]] ? template[key] : nil];
+	}
+	[self appendLiteral:"}"];
+}
+
+- (void)writeArray:(NSArray *)array template:(id)template {
+	id elementTemplate = [template isKindOfClass:[NSArray class]] ? [template firstObject] : nil;
+	BOOL first = YES;
+	
+	[self appendLiteral:"["];
+	for (id elem in array) {
+		if (!first)
+			[self appendLiteral:","];
+		first = NO;
+		[self writeValue:elem template:elementTemplate];
+	}
+	[self appendLiteral:"]"];
+}
+
+- (void)writeNumber:(NSNumber *)number {
+	if (CFGetTypeID((__bridge CFTypeRef)number) == CFBooleanGetTypeID()) {
+		[self appendLiteral:number.boolValue ? "true" : "false"];
+		return;
+	}
+	
+	if ([number isKindOfClass:[NSDecimalNumber class]]) {
+		// decimals can carry more digits than fit in a double or a long long
+		NSDecimal decimal = number.decimalValue;
+		if (NSDecimalIsNotANumber(&decimal))
+			[self appendLiteral:"null"];
+		else
+			[self appendLiteral:number.stringValue.UTF8String];
+		return;
+	}
+	
+	char buffer[32];
+	const char *type = number.objCType;
+	
+	if (type[0] == 'd' || type[0] == 'f') {
+		double value = number.doubleValue;
+		if (!isfinite(value)) {
+			[self appendLiteral:"null"]; // JSON has no representation for these
+			return;
+		}
+		snprintf(buffer, sizeof(buffer), "%.15g", value);
+		if (strtod(buffer, NULL) != value)
+			snprintf(buffer, sizeof(buffer), "%.17g", value); // only use the full precision when it's needed to round-trip
+	} else if (type[0] == 'Q' || type[0] == 'L' || type[0] == 'I' || type[0] == 'S' || type[0] == 'C') {
+		snprintf(buffer, sizeof(buffer), "%llu", number.unsignedLongLongValue);
+	} else {
+		snprintf(buffer, sizeof(buffer), "%lld", number.longLongValue);
+	}
+	
+	[self appendLiteral:buffer];
+}
+
+- (void)writeString:(NSString *)string {
+	[self appendLiteral:"\""];
+	
+	// only handed out for ASCII contents, so the length is known (and strlen would stop at an embedded NUL)
+	const char *utf8 = CFStringGetCStringPtr((__bridge CFStringRef)string, kCFStringEncodingUTF8);
+	if (utf8) {
+		[self appendEscaped:(const uint8_t *)utf8 length:string.length];
+	} else {
+		uint8_t buffer[256];
+		NSUInteger used;
+		NSRange range = NSMakeRange(0, string.length), remaining;
+		while (range.length) {
+			if ([string getBytes:buffer maxLength:sizeof(buffer) usedLength:&used encoding:NSUTF8StringEncoding options:0 range:range remainingRange:&remaining] && used) {
+				[self appendEscaped:buffer length:used];
+				range = remaining;
+				continue;
+			}
+			
+			// an unpaired surrogate has no UTF-8 form, but it can still be escaped as-is
+			char escape[8];
+			snprintf(escape, sizeof(escape), "\\u%04x", [string characterAtIndex:range.location]);
+			[self appendLiteral:escape];
+			range = NSMakeRange(range.location + 1, range.length - 1);
+		}
+	}
+	
+	[self appendLiteral:"\""];
+}
+
+- (void)appendEscaped:(const uint8_t *)bytes length:(NSUInteger)length {
+	NSUInteger start = 0;
+	
+	for (NSUInteger i = 0; i < length; i++) {
+		uint8_t c = bytes[i];
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+		
+		[self appendBytes:bytes + start length:i - start];
+		start = i + 1;
+		
+		switch (c) {
+			case '"': [self appendLiteral:"\\\""]; break;
+			case '\\': [self appendLiteral:"\\\\"]; break;
+			case '\n': [self appendLiteral:"\\n"]; break;
+			case '\r': [self appendLiteral:"\\r"]; break;
+			case '\t': [self appendLiteral:"\\t"]; break;
+			case '\b': [self appendLiteral:"\\b"]; break;
+			case '\f': [self appendLiteral:"\\f"]; break;
+			default: {
+				char escape[8];
+				snprintf(escape, sizeof(escape), "\\u%04x", c);
+				[self appendLiteral:escape];
+			}
+		}
+	}
+	
+	[self appendBytes:bytes + start length:length - start];
+}
+
+@end
+
+#pragma mark - Codecs
+
+@implementation PrestoJSONCodec
+
+- (NSString *)contentType {
+	return @"application/json";
+}
+
+- (id)objectWithData:(NSData *)data {
+	return [NSJSONSerialization JSONObjectWithData:data options:NSJSONReadingMutableContainers error:nil];
+}
+
+- (NSData *)dataWithObject:(id)object {
+	return [NSJSONSerialization dataWithJSONObject:object options:0 error:nil];
+}
+
+@end
+
+// MessagePack (https://msgpack.org); multi-byte values are big-endian
+static const NSUInteger PrestoMessagePackMaxDepth = 512; // containers nested deeper than this are rejected rather than recursed into
+
+static id PrestoMessagePackRead(const uint8_t *bytes, NSUInteger length, NSUInteger *offset, NSUInteger depth);
+
+// reads n big-endian bytes, or returns NO if there aren't enough
+static BOOL PrestoMessagePackReadUInt(const uint8_t *bytes, NSUInteger length, NSUInteger *offset, NSUInteger n, uint64_t *value) {
+	if (length - *offset < n)
+		return NO;
+	uint64_t result = 0;
+	for (NSUInteger i = 0; i < n; i++)
+		result = (result << 8) | bytes[*offset + i];
+	*offset += n;
+	*value = result;
+	return YES;
+}
+
+static id PrestoMessagePackReadString(const uint8_t *bytes, NSUInteger length, NSUInteger *offset, uint64_t count) {
+	if (length - *offset < count)
+		return nil;
+	NSString *string = [[NSString alloc] initWithBytes:bytes + *offset length:(NSUInteger)count encoding:NSUTF8StringEncoding];
+	*offset += count;
+	return string;
+}
+
+static id PrestoMessagePackReadArray(const uint8_t *bytes, NSUInteger length, NSUInteger *offset, uint64_t count, NSUInteger depth) {
+	NSMutableArray *array = [NSMutableArray arrayWithCapacity:(NSUInteger)MIN(count, length - *offset)]; // don't trust the count for the capacity
+	for (uint64_t i = 0; i < count; i++) {
+		id elem = PrestoMessagePackRead(bytes, length, offset, depth + 1);
+		if (!elem)
+			return nil;
+		[array addObject:elem];
+	}
+	return array;
+}
+
+static id PrestoMessagePackReadMap(const uint8_t *bytes, NSUInteger length, NSUInteger *offset, uint64_t count, NSUInteger depth) {
+	NSMutableDictionary *dictionary = [NSMutableDictionary dictionaryWithCapacity:(NSUInteger)MIN(count, length - *offset)];
+	for (uint64_t i = 0; i < count; i++) {
+		id key = PrestoMessagePackRead(bytes, length, offset, depth + 1);
+		id value = key ? PrestoMessagePackRead(bytes, length, offset, depth + 1) : nil;
+		if (!value || ![key conformsToProtocol:@protocol(NSCopying)])
+			return nil;
+		if (![key isKindOfClass:[NSString class]])
+			key = [key description]; // JSON only has string keys, and neither does anything that binds them
+		dictionary[key] = value;
+	}
+	return dictionary;
+}
+
+// returns nil for malformed data
+static id PrestoMessagePackRead(const uint8_t *bytes, NSUInteger length, NSUInteger *offset, NSUInteger depth) {
+	if (*offset >= length || depth > PrestoMessagePackMaxDepth)
+		return nil;
+	
+	uint8_t type = bytes[(*offset)++];
+	uint64_t value;
+	
+	if (type <= 0x7f)
+		return @(type); // positive fixint
+	if (type >= 0xe0)
+		return @((int8_t)type); // negative fixint
+	if ((type & 0xf0) == 0x80)
+		return PrestoMessagePackReadMap(bytes, length, offset, type & 0x0f, depth);
+	if ((type & 0xf0) == 0x90)
+		return PrestoMessagePackReadArray(bytes, length, offset, type & 0x0f, depth);
+	if ((type & 0xe0) == 0xa0)
+		return PrestoMessagePackReadString(bytes, length, offset, type & 0x1f);
+	
+	switch (type) {
+		case 0xc0: return [NSNull null];
+		case 0xc2: return @NO;
+		case 0xc3: return @YES;
+		
+		case 0xc4: case 0xc5: case 0xc6: { // bin 8/16/32
+			if (!PrestoMessagePackReadUInt(bytes, length, offset, 1 << (type - 0xc4), &value) || length - *offset < value)
+				return nil;
+			NSData *data = [NSData dataWithBytes:bytes + *offset length:(NSUInteger)value];
+			*offset += value;
+			return data;
+		}
+		
+		case 0xc7: case 0xc8: case 0xc9: // ext 8/16/32
+			if (!PrestoMessagePackReadUInt(bytes, length, offset, 1 << (type - 0xc7), &value) || length - *offset < value + 1)
+				return nil;
+			*offset += value + 1; // the type byte and data; extensions have no JSON equivalent
+			return [NSNull null];
+		case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8: // fixext 1/2/4/8/16
+			if (length - *offset < (1 << (type - 0xd4)) + 1)
+				return nil;
+			*offset += (1 << (type - 0xd4)) + 1;
+			return [NSNull null];
+		
+		case 0xca: { // float 32
+			if (!PrestoMessagePackReadUInt(bytes, length, offset, 4, &value))
+				return nil;
+			uint32_t bits = (uint32_t)value;
+			float f;
+			memcpy(&f, &bits, sizeof(f));
+			return @(f);
+		}
+		case 0xcb: { // float 64
+			if (!PrestoMessagePackReadUInt(bytes, length, offset, 8, &value))
+				return nil;
+			double d;
+			memcpy(&d, &value, sizeof(d));
+			return @(d);
+		}
+		
+		case 0xcc: case 0xcd: case 0xce: case 0xcf: // uint 8/16/32/64
+			if (!PrestoMessagePackReadUInt(bytes, length, offset, 1 << (type - 0xcc), &value))
+				return nil;
+			return @((unsigned long long)value);
+		case 0xd0: case 0xd1: case 0xd2: case 0xd3: { // int 8/16/32/64
+			NSUInteger n = 1 << (type - 0xd0);
+			if (!PrestoMessagePackReadUInt(bytes, length, offset, n, &value))
+				return nil;
+			int64_t signedValue = n == 8 ? (int64_t)value : (int64_t)(value << (64 - n * 8)) >> (64 - n * 8); // sign extend
+			return @((long long)signedValue);
+		}
+		
+		case 0xd9: case 0xda: case 0xdb: // str 8/16/32
+			if (!PrestoMessagePackReadUInt(bytes, length, offset, 1 << (type - 0xd9), &value))
+				return nil;
+			return PrestoMessagePackReadString(bytes, length, offset, value);
+		case 0xdc: case 0xdd: // array 16/32
+			if (!PrestoMessagePackReadUInt(bytes, length, offset, type == 0xdc ? 2 : 4, &value))
+				return nil;
+			return PrestoMessagePackReadArray(bytes, length, offset, value, depth);
+		case 0xde: case 0xdf: // map 16/32
+			if (!PrestoMessagePackReadUInt(bytes, length, offset, type == 0xde ? 2 : 4, &value))
+				return nil;
+			return PrestoMessagePackReadMap(bytes, length, offset, value, depth);
+		
+		default:
+			return nil; // 0xc1 is never used
+	}
+}
+
+static void PrestoMessagePackWriteHeader(NSMutableData *data, uint8_t type, uint64_t value, NSUInteger n) {
+	uint8_t buffer[9];
+	buffer[0] = type;
+	for (NSUInteger i = 0; i < n; i++)
+		buffer[1 + i] = (uint8_t)(value >> (8 * (n - 1 - i)));
+	[data appendBytes:buffer length:1 + n];
+}
+
+// picks the smallest of the 8/16/32-bit length forms starting at type8 (or the fix form if given and the length fits)
+static void PrestoMessagePackWriteLength(NSMutableData *data, NSUInteger count, uint8_t fixType, NSUInteger fixLimit, uint8_t type8) {
+	if (fixType && count < fixLimit)
+		PrestoMessagePackWriteHeader(data, fixType | (uint8_t)count, 0, 0);
+	else if (type8 && count <= UINT8_MAX)
+		PrestoMessagePackWriteHeader(data, type8, count, 1);
+	else if (count <= UINT16_MAX)
+		PrestoMessagePackWriteHeader(data, type8 ? type8 + 1 : fixType == 0x90 ? 0xdc : 0xde, count, 2);
+	else
+		PrestoMessagePackWriteHeader(data, type8 ? type8 + 2 : fixType == 0x90 ? 0xdd : 0xdf, count, 4);
+}
+
+static void PrestoMessagePackWriteNumber(NSMutableData *data, NSNumber *number) {
+	if ((__bridge CFBooleanRef)number == kCFBooleanTrue || (__bridge CFBooleanRef)number == kCFBooleanFalse) {
+		PrestoMessagePackWriteHeader(data, number.boolValue ? 0xc3 : 0xc2, 0, 0);
+		return;
+	}
+	
+	const char *type = number.objCType;
+	if (type[0] == 'f' || type[0] == 'd') {
+		double d = number.doubleValue;
+		uint64_t bits;
+		memcpy(&bits, &d, sizeof(bits));
+		PrestoMessagePackWriteHeader(data, 0xcb, bits, 8);
+		return;
+	}
+	
+	if (type[0] == 'Q' || type[0] == 'L' || type[0] == 'I') {
+		unsigned long long value = number.unsignedLongLongValue;
+		if (value > INT64_MAX) {
+			PrestoMessagePackWriteHeader(data, 0xcf, value, 8);
+			return;
+		}
+	}
+	
+	long long value = number.longLongValue;
+	if (value >= 0) {
+		if (value <= 0x7f)
+			PrestoMessagePackWriteHeader(data, (uint8_t)value, 0, 0);
+		else if (value <= UINT8_MAX)
+			PrestoMessagePackWriteHeader(data, 0xcc, value, 1);
+		else if (value <= UINT16_MAX)
+			PrestoMessagePackWriteHeader(data, 0xcd, value, 2);
+		else if (value <= UINT32_MAX)
+			PrestoMessagePackWriteHeader(data, 0xce, value, 4);
+		else
+			PrestoMessagePackWriteHeader(data, 0xcf, value, 8);
+	} else {
+		if (value >= -32)
+			PrestoMessagePackWriteHeader(data, (uint8_t)(int8_t)value, 0, 0);
+		else if (value >= INT8_MIN)
+			PrestoMessagePackWriteHeader(data, 0xd0, (uint8_t)value, 1);
+		else if (value >= INT16_MIN)
+			PrestoMessagePackWriteHeader(data, 0xd1, (uint16_t)value, 2);
+		else if (value >= INT32_MIN)
+			PrestoMessagePackWriteHeader(data, 0xd2, (uint32_t)value, 4);
+		else
+			PrestoMessagePackWriteHeader(data, 0xd3, (uint64_t)value, 8);
+	}
+}
+
+static void PrestoMessagePackWrite(NSMutableData *data, id object) {
+	if ([object isKindOfClass:[NSString class]]) {
+		NSData *utf8 = [(NSString *)object dataUsingEncoding:NSUTF8StringEncoding];
+		PrestoMessagePackWriteLength(data, utf8.length, 0xa0, 32, 0xd9);
+		[data appendData:utf8];
+	} else if ([object isKindOfClass:[NSNumber class]]) {
+		PrestoMessagePackWriteNumber(data, object);
+	} else if ([object isKindOfClass:[NSDictionary class]]) {
+		PrestoMessagePackWriteLength(data, [object count], 0x80, 16, 0);
+		[(NSDictionary *)object enumerateKeysAndObjectsUsingBlock:^(id key, id value, BOOL *stop) {
+			PrestoMessagePackWrite(data, [key isKindOfClass:[NSString class]] ? key : [key description]);
+			PrestoMessagePackWrite(data, value);
+		}];
+	} else if ([object isKindOfClass:[NSArray class]]) {
+		PrestoMessagePackWriteLength(data, [object count], 0x90, 16, 0);
+		for (id elem in (NSArray *)object)
+			PrestoMessagePackWrite(data, elem);
+	} else if ([object isKindOfClass:[NSData class]]) {
+		PrestoMessagePackWriteLength(data, [object length], 0, 0, 0xc4);
+		[data appendData:object];
+	} else {
+		PrestoMessagePackWriteHeader(data, 0xc0, 0, 0); // nil, NSNull and anything JSON couldn't hold either
+	}
+}
+
+@implementation PrestoMessagePackCodec
+
+- (NSString *)contentType {
+	return @"application/msgpack";
+}
+
+- (id)objectWithData:(NSData *)data {
+	const uint8_t *bytes = data.bytes;
+	NSUInteger offset = 0;
+	id result = PrestoMessagePackRead(bytes, data.length, &offset, 0);
+	return offset == data.length ? result : nil; // nil if truncated or followed by garbage
+}
+
+- (NSData *)dataWithObject:(id)object {
+	NSMutableData *data = [NSMutableData new];
+	PrestoMessagePackWrite(data, object);
+	return data;
+}
+
+@end
+
+#pragma mark - Compression
+
+// crc-32 as used by gzip (polynomial 0xedb88320)
+static uint32_t PrestoCRC32(const uint8_t *bytes, NSUInteger length) {
+	static uint32_t table[256];
+	static dispatch_once_t once;
+	dispatch_once(&once, ^{
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	});
+	
+	uint32_t crc = 0xffffffff;
+	for (NSUInteger i = 0; i < length; i++)
+		crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+	return crc ^ 0xffffffff;
+}
+
+// the Compression library's zlib encoder writes a raw deflate stream, so we wrap it in a gzip header and trailer ourselves
+static NSData *PrestoGzipData(NSData *data) {
+	if (!data.length)
+		return data;
+	
+	size_t capacity = data.length + data.length / 16 + 64; // deflate's worst case is only slightly larger than the input
+	uint8_t *buffer = malloc(capacity);
+	size_t compressedLength = compression_encode_buffer(buffer, capacity, data.bytes, data.length, NULL, COMPRESSION_ZLIB);
+	if (!compressedLength) {
+		free(buffer);
+		return nil;
+	}
+	
+	static const uint8_t header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff }; // deflate, no name or timestamp, unknown OS
+	uint32_t crc = PrestoCRC32(data.bytes, data.length);
+	uint32_t size = (uint32_t)data.length;
+	uint8_t trailer[8] = {
+		crc, crc >> 8, crc >> 16, crc >> 24, // little-endian, unlike everything else
+		size, size >> 8, size >> 16, size >> 24
+	};
+	
+	NSMutableData *result = [NSMutableData dataWithCapacity:sizeof(header) + compressedLength + sizeof(trailer)];
+	[result appendBytes:header length:sizeof(header)];
+	[result appendBytes:buffer length:compressedLength];
+	[result appendBytes:trailer length:sizeof(trailer)];
+	free(buffer);
+	return result;
+}
+
+#pragma mark - Lazy collections
+
+// shared by both lazy collections: the instance to store in place of elem, or nil if elem stays as it is
+static id PrestoMaterializeElement(id elem, Class class, Presto *manager, id container) {
+	if (![elem isKindOfClass:[NSDictionary class]] || [elem isKindOfClass:class] || !manager)
+		return nil;
+	
+	NSObject *instance = [manager instantiateClass:class withDictionary:elem];
+	if (instance && manager.trackParentObjects)
+		instance.presto.parent = container;
+	return instance;
+}
+
+@implementation PrestoLazyArray {
+	NSMutableArray *_storage;
+}
+
+- (instancetype)init {
+	return [self initWithCapacity:0];
+}
+
+- (instancetype)initWithCapacity:(NSUInteger)numItems {
+	if ((self = [super init])) {
+		_storage = [NSMutableArray arrayWithCapacity:numItems];
+	}
+	return self;
+}
+
+- (instancetype)initWithElementClass:(Class)class manager:(Presto *)manager {
+	if ((self = [self initWithCapacity:0])) {
+		self.elementClass = class;
+		self.manager = manager;
+	}
+	return self;
+}
+
+- (NSUInteger)count {
+	@synchronized (self) {
+		return _storage.count;
+	}
+}
+
+// enumeration and every other NSArray method come through here, so elements are materialized as they are read
+// materializing runs user code (objectWillLoad: and friends, which may well read this array), so it happens outside the lock
+// and the instance is only stored if the element is still the one it was made from; otherwise whatever replaced it wins
+- (id)objectAtIndex:(NSUInteger)index {
+	id result;
+	@synchronized (self) {
+		result = _storage[index];
+	}
+	
+	id instance;
+	while ((instance = PrestoMaterializeElement(result, self.elementClass, self.manager, self))) {
+		@synchronized (self) {
+			if (index >= _storage.count) {
+				result = instance; // removed in the meantime; the caller still gets what it read
+			} else if (_storage[index] == result) {
+				_storage[index] = instance;
+				result = instance;
+			} else
+				result = _storage[index];
+		}
+	}
+	
+	[self.metadata didConsumeElementAtIndex:index]; // outside the lock, as this may start loading the next page
+	return result;
+}
+
+- (id)rawObjectAtIndex:(NSUInteger)index {
+	@synchronized (self) {
+		return _storage[index];
+	}
+}
+
+- (BOOL)isMaterializedAtIndex:(NSUInteger)index {
+	@synchronized (self) {
+		return ![_storage[index] isKindOfClass:[NSDictionary class]];
+	}
+}
+
+- (void)insertObject:(id)anObject atIndex:(NSUInteger)index {
+	@synchronized (self) {
+		[_storage insertObject:anObject atIndex:index];
+	}
+}
+
+- (void)removeObjectAtIndex:(NSUInteger)index {
+	@synchronized (self) {
+		[_storage removeObjectAtIndex:index];
+	}
+}
+
+- (void)addObject:(id)anObject {
+	@synchronized (self) {
+		[_storage addObject:anObject];
+	}
+}
+
+- (void)removeLastObject {
+	@synchronized (self) {
+		[_storage removeLastObject];
+	}
+}
+
+- (void)replaceObjectAtIndex:(NSUInteger)index withObject:(id)anObject {
+	@synchronized (self) {
+		[_storage replaceObjectAtIndex:index withObject:anObject];
+	}
+}
+
+- (void)setArray:(NSArray *)otherArray {
+	// copy raw elements across so that reconciling doesn't materialize them
+	NSArray *elements = [otherArray isKindOfClass:[PrestoLazyArray class]] ? [(PrestoLazyArray *)otherArray rawElements] : otherArray;
+	@synchronized (self) {
+		[_storage setArray:elements];
+	}
+}
+
+- (NSArray *)rawElements {
+	@synchronized (self) {
+		return [_storage copy];
+	}
+}
+
+@end
+
+@implementation PrestoLazyDictionary {
+	NSMutableDictionary *_storage;
+}
+
+- (instancetype)init {
+	return [self initWithCapacity:0];
+}
+
+- (instancetype)initWithCapacity:(NSUInteger)numItems {
+	if ((self = [super init])) {
+		_storage = [NSMutableDictionary dictionaryWithCapacity:numItems];
+	}
+	return self;
+}
+
+- (instancetype)initWithElementClass:(Class)class manager:(Presto *)manager {
+	if ((self = [self initWithCapacity:0])) {
+		self.elementClass = class;
+		self.manager = manager;
+	}
+	return self;
+}
+
+- (NSUInteger)count {
+	@synchronized (self) {
+		return _storage.count;
+	}
+}
+
+// materialized outside the lock, like PrestoLazyArray's objectAtIndex:
+- (id)objectForKey:(id)aKey {
+	id result;
+	@synchronized (self) {
+		result = _storage[aKey];
+	}
+	
+	id instance;
+	while ((instance = PrestoMaterializeElement(result, self.elementClass, self.manager, self))) {
+		@synchronized (self) {
+			id current = _storage[aKey];
+			if (current == result) {
+				_storage[aKey] = instance;
+				result = instance;
+			} else
+				result = current;
+		}
+	}
+	
+	return result;
+}
+
+- (id)rawObjectForKey:(id)key {
+	@synchronized (self) {
+		return _storage[key];
+	}
+}
+
+// enumerates a snapshot of the keys, since reading values may replace them in storage
+- (NSEnumerator *)keyEnumerator {
+	@synchronized (self) {
+		return [[_storage allKeys] objectEnumerator];
+	}
+}
+
+- (void)setObject:(id)anObject forKey:(id<NSCopying>)aKey {
+	@synchronized (self) {
+		_storage[aKey] = anObject;
+	}
+}
+
+- (void)removeObjectForKey:(id)aKey {
+	@synchronized (self) {
+		[_storage removeObjectForKey:aKey];
+	}
+}
+
+@end
+
+#pragma mark - PrestoStreamingTask
+
+@implementation PrestoStreamingTask
+
+@end
+
+#pragma mark - PrestoLoadContext
+
+@implementation PrestoLoadContext
+
++ (instancetype)contextWithMetrics:(PrestoRequestMetrics *)metrics deferredLoads:(NSMutableArray *)deferredLoads {
+	if (!metrics && !deferredLoads)
+		return nil; // same as no context at all
+	PrestoLoadContext *context = [self new];
+	context.metrics = metrics;
+	context.deferredLoads = deferredLoads;
+	return context;
+}
+
+@end
+
+#pragma mark - PrestoResponseCache
+
+// each record in the cache file is this header followed by the key, ETag, Last-Modified, Content-Type and payload bytes
+// the file is written in host byte order; it is a local cache, not an interchange format
+typedef struct {
+	uint32_t magic;
+	uint32_t keyLength;
+	uint32_t entityTagLength;
+	uint32_t lastModifiedLength;
+	uint32_t contentTypeLength;
+	uint64_t payloadLength;
+	double loadedTime; // since the reference date
+} PrestoCacheRecordHeader;
+
+static const uint32_t PrestoCacheRecordMagic = 0x50524332; // PRC2; files of earlier versions are discarded when opened, like a torn write
+
+@implementation PrestoCacheEntry
+
+@end
+
+@interface PrestoResponseCache ()
+
+@property (readwrite, strong, nonatomic) NSString *path;
+@property (readwrite, nonatomic) NSUInteger size;
+@property (strong, nonatomic) NSMutableDictionary *index;		// PrestoCacheEntries keyed on source identity
+@property (strong, nonatomic) NSData *mappedData;				// the cache file, mapped on demand and dropped after every write
+@property (strong, nonatomic) NSFileHandle *fileHandle;
+@property (nonatomic) unsigned long long fileLength;
+@property (nonatomic) NSUInteger accessClock;
+
+@end
+
+@implementation PrestoResponseCache
+
+- (instancetype)initWithPath:(NSString *)path {
+	return [self initWithPath:path capacity:10 * 1024 * 1024];
+}
+
+- (instancetype)initWithPath:(NSString *)path capacity:(NSUInteger)capacity {
+	self = [super init];
+	if (self) {
+		self.path = path;
+		self.capacity = capacity;
+		self.index = [NSMutableDictionary new];
+		
+		[self open];
+	}
+	return self;
+}
+
+- (void)dealloc {
+	[_fileHandle closeFile];
+}
+
+#pragma mark -
+
+- (PrestoCacheEntry *)entryForKey:(NSString *)key {
+	@synchronized (self) {
+		PrestoCacheEntry *entry = self.index[key];
+		if (entry == nil)
+			return nil;
+		
+		entry.lastAccess = ++self.accessClock;
+		
+		PrestoCacheEntry *result = [PrestoCacheEntry new];
+		result.key = entry.key;
+		result.entityTag = entry.entityTag;
+		result.lastModified = entry.lastModified;
+		result.contentType = entry.contentType;
+		result.loadedTime = entry.loadedTime;
+		result.payload = [[self mappedFile] subdataWithRange:NSMakeRange((NSUInteger)entry.payloadOffset, (NSUInteger)entry.payloadLength)];
+		return result;
+	}
+}
+
+- (void)storePayload:(NSData *)payload entityTag:(NSString *)entityTag lastModified:(NSString *)lastModified contentType:(NSString *)contentType forKey:(NSString *)key {
+	if (!payload || !key)
+		return;
+	
+	NSData *keyData = [key dataUsingEncoding:NSUTF8StringEncoding];
+	NSData *entityTagData = [entityTag ?: @"" dataUsingEncoding:NSUTF8StringEncoding];
+	NSData *lastModifiedData = [lastModified ?: @"" dataUsingEncoding:NSUTF8StringEncoding];
+	NSData *contentTypeData = [contentType ?: @"" dataUsingEncoding:NSUTF8StringEncoding];
+	NSDate *loadedTime = [NSDate date];
+	
+	PrestoCacheRecordHeader header = {
+		.magic = PrestoCacheRecordMagic,
+		.keyLength = (uint32_t)keyData.length,
+		.entityTagLength = (uint32_t)entityTagData.length,
+		.lastModifiedLength = (uint32_t)lastModifiedData.length,
+		.contentTypeLength = (uint32_t)contentTypeData.length,
+		.payloadLength = payload.length,
+		.loadedTime = loadedTime.timeIntervalSinceReferenceDate,
+	};
+	
+	NSMutableData *record = [NSMutableData dataWithCapacity:sizeof(header) + keyData.length + entityTagData.length + lastModifiedData.length + contentTypeData.length + payload.length];
+	[record appendBytes:&header length:sizeof(header)];
+	[record appendData:keyData];
+	[record appendData:entityTagData];
+	[record appendData:lastModifiedData];
+	[record appendData:contentTypeData];
+	[record appendData:payload];
+	
+	if (record.length > self.capacity)
+		return; // would evict everything else and still not fit
+	
+	@synchronized (self) {
+		@try {
+			[self.fileHandle seekToEndOfFile];
+			[self.fileHandle writeData:record];
+		}
+		@catch (NSException *exception) {
+			if (LOG_ERRORS)
+				PRLog(@"pRESTo Error: Couldn’t write to response cache at %@: %@", self.path, exception);
+			return;
+		}
+		
+		PrestoCacheEntry *entry = [PrestoCacheEntry new];
+		entry.key = key;
+		entry.offset = self.fileLength;
+		entry.length = record.length;
+		entry.payloadOffset = entry.offset + record.length - payload.length;
+		entry.payloadLength = payload.length;
+		entry.entityTag = entityTag;
+		entry.lastModified = lastModified;
+		entry.contentType = contentType;
+		entry.loadedTime = loadedTime;
+		[self indexEntry:entry];
+		
+		self.fileLength += record.length;
+		self.mappedData = nil;
+		
+		if (self.size > self.capacity)
+			[self evict];
+		else if (self.fileLength > 2 * (unsigned long long)self.capacity)
+			[self compact]; // too many superseded records
+	}
+}
+
+- (void)removeAllEntries {
+	@synchronized (self) {
+		[self.index removeAllObjects];
+		self.size = 0;
+		[self compact];
+	}
+}
+
+#pragma mark -
+
+- (void)open {
+	NSFileManager *fileManager = [NSFileManager defaultManager];
+	if (![fileManager fileExistsAtPath:self.path]) {
+		[fileManager createDirectoryAtPath:[self.path stringByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:nil];
+		[fileManager createFileAtPath:self.path contents:nil attributes:nil];
+	}
+	
+	// rebuild the index by scanning the records; a later record for the same key supersedes an earlier one
+	NSData *data = [self mappedFile];
+	const uint8_t *bytes = data.bytes;
+	unsigned long long length = data.length, offset = 0;
+	
+	while (offset + sizeof(PrestoCacheRecordHeader) <= length) {
+		PrestoCacheRecordHeader header;
+		memcpy(&header, bytes + offset, sizeof(header));
+		
+		unsigned long long recordLength = sizeof(header) + (unsigned long long)header.keyLength + header.entityTagLength + header.lastModifiedLength + header.contentTypeLength + header.payloadLength;
+		if (header.magic != PrestoCacheRecordMagic || offset + recordLength > length)
+			break; // a torn write; everything from here on is discarded
+		
+		const uint8_t *field = bytes + offset + sizeof(header);
+		PrestoCacheEntry *entry = [PrestoCacheEntry new];
+		entry.key = [[NSString alloc] initWithBytes:field length:header.keyLength encoding:NSUTF8StringEncoding];
+		field += header.keyLength;
+		entry.entityTag = header.entityTagLength ? [[NSString alloc] initWithBytes:field length:header.entityTagLength encoding:NSUTF8StringEncoding] : nil;
+		field += header.entityTagLength;
+		entry.lastModified = header.lastModifiedLength ? [[NSString alloc] initWithBytes:field length:header.lastModifiedLength encoding:NSUTF8StringEncoding] : nil;
+		field += header.lastModifiedLength;
+		entry.contentType = header.contentTypeLength ? [[NSString alloc] initWithBytes:field length:header.contentTypeLength encoding:NSUTF8StringEncoding] : nil;
+		entry.offset = offset;
+		entry.length = recordLength;
+		entry.payloadOffset = offset + recordLength - header.payloadLength;
+		entry.payloadLength = header.payloadLength;
+		entry.loadedTime = [NSDate dateWithTimeIntervalSinceReferenceDate:header.loadedTime];
+		
+		if (entry.key)
+			[self indexEntry:entry];
+		
+		offset += recordLength;
+	}
+	
+	self.fileHandle = [NSFileHandle fileHandleForUpdatingAtPath:self.path];
+	if (offset < length) {
+		[self.fileHandle truncateFileAtOffset:offset];
+		self.mappedData = nil;
+	}
+	self.fileLength = offset;
+	
+	if (self.size > self.capacity)
+		[self evict];
+}
+
+- (NSData *)mappedFile {
+	if (self.mappedData == nil)
+		self.mappedData = [NSData dataWithContentsOfFile:self.path options:NSDataReadingMappedAlways error:nil] ?: [NSData data];
+	return self.mappedData;
+}
+
+- (void)indexEntry:(PrestoCacheEntry *)entry {
+	PrestoCacheEntry *superseded = self.index[entry.key];
+	if (superseded)
+		self.size -= superseded.length;
+	
+	entry.lastAccess = ++self.accessClock;
+	self.index[entry.key] = entry;
+	self.size += entry.length;
+}
+
+// drops least recently used entries down to three quarters of capacity, so every eviction isn't followed by another soon after
+- (void)evict {
+	NSArray *entries = [self.index.allValues sortedArrayUsingComparator:^NSComparisonResult(PrestoCacheEntry *a, PrestoCacheEntry *b) {
+		return a.lastAccess < b.lastAccess ? NSOrderedAscending : (a.lastAccess > b.lastAccess ? NSOrderedDescending : NSOrderedSame);
+	}];
+	
+	for (PrestoCacheEntry *entry in entries) {
+		if (self.size <= self.capacity / 4 * 3)
+			break;
+		[self.index removeObjectForKey:entry.key];
+		self.size -= entry.length;
+	}
+	
+	[self compact];
+}
+
+// rewrites the file with only the live records, least recently used first, so the order survives a relaunch
+- (void)compact {
+	NSData *data = [self mappedFile];
+	NSString *temporaryPath = [self.path stringByAppendingPathExtension:@"tmp"];
+	NSMutableData *compacted = [NSMutableData dataWithCapacity:self.size];
+	
+	NSArray *entries = [self.index.allValues sortedArrayUsingComparator:^NSComparisonResult(PrestoCacheEntry *a, PrestoCacheEntry *b) {
+		return a.lastAccess < b.lastAccess ? NSOrderedAscending : (a.lastAccess > b.lastAccess ? NSOrderedDescending : NSOrderedSame);
+	}];
+	
+	for (PrestoCacheEntry *entry in entries) {
+		unsigned long long offset = compacted.length;
+		[compacted appendBytes:(const uint8_t *)data.bytes + entry.offset length:(NSUInteger)entry.length];
+		entry.payloadOffset = entry.payloadOffset - entry.offset + offset;
+		entry.offset = offset;
+	}
+	
+	self.mappedData = nil;
+	[self.fileHandle closeFile];
+	
+	if (![compacted writeToFile:temporaryPath atomically:NO] || ![[NSFileManager defaultManager] replaceItemAtURL:[NSURL fileURLWithPath:self.path] withItemAtURL:[NSURL fileURLWithPath:temporaryPath] backupItemName:nil options:0 resultingItemURL:nil error:nil]) {
+		if (LOG_ERRORS)
+			PRLog(@"pRESTo Error: Couldn’t compact response cache at %@. Clearing it.", self.path);
+		[[NSFileManager defaultManager] createFileAtPath:self.path contents:nil attributes:nil];
+		[self.index removeAllObjects];
+		self.size = 0;
+		compacted = [NSMutableData data];
+	}
+	
+	self.fileHandle = [NSFileHandle fileHandleForUpdatingAtPath:self.path];
+	self.fileLength = compacted.length;
+}
+
+@end
+
+#pragma mark - PrestoQueuedRequest
+
+@implementation PrestoQueuedRequest
+@end
+
+@implementation PrestoDeallocObserver
+
+- (void)dealloc {
+	if (self.block)
+		self.block();
+}
+
+@end
+
+#pragma mark - PrestoScheduledRefresh
+
+@implementation PrestoScheduledRefresh
+@end
+
+#pragma mark - PrestoArrayDiff
+
+// a content hash for raw JSON values; NSDictionary and NSArray only hash their count, which would make every raw container collide
+static NSUInteger PrestoContentHash(id object) {
+	if ([object isKindOfClass:[NSDictionary class]]) {
+		NSUInteger hash = [object count];
+		for (id key in object)
+			hash += [key hash] * 31 ^ PrestoContentHash([object objectForKey:key]); // order independent
+		return hash;
+	} else if ([object isKindOfClass:[NSArray class]]) {
+		NSUInteger hash = [object count];
+		for (id elem in object)
+			hash = hash * 31 + PrestoContentHash(elem);
+		return hash;
+	}
+	return [object hash];
+}
+
+// wraps an array element so it can be looked up by identifyingKey (or content) in a hash table
+@interface PrestoIdentity : NSObject
+
+@property (strong, nonatomic) id value;
+@property (nonatomic) BOOL isKey;
+@property (nonatomic) NSUInteger contentHash;
+
++ (instancetype)identityOf:(id)object;
++ (instancetype)identityOf:(id)object withKey:(id)key; // for raw elements whose key comes from identifyingKeyForDictionary: or identifyingField
+
+@end
+
+@implementation PrestoIdentity
+
++ (instancetype)identityOf:(id)object {
+	id key;
+	if ([object respondsToSelector:@selector(identifyingKey)])
+		key = [(id<PrestoDelegate>)object identifyingKey];
+	return [self identityOf:object withKey:key];
+}
+
++ (instancetype)identityOf:(id)object withKey:(id)key {
+	PrestoIdentity *identity = [PrestoIdentity new];
+	identity.value = key;
+	identity.isKey = identity.value != nil;
+	if (!identity.isKey)
+		identity.value = object;
+	identity.contentHash = PrestoContentHash(identity.value);
+	return identity;
+}
+
+- (NSUInteger)hash {
+	return self.contentHash;
+}
+
+- (BOOL)isEqual:(id)object {
+	if (![object isKindOfClass:[PrestoIdentity class]])
+		return NO;
+	PrestoIdentity *other = object;
+	return self.isKey == other.isKey && self.contentHash == other.contentHash && [self.value isEqual:other.value];
 }
 
-// now that these are like this should we bother with the method or just expose the array again?
-- (void)addGlobalRequestTransformer:(PrestoRequestTransformer)transformer {
-//	[self addRequestTransformer:transformer forClass:[NSObject class]];
-	[self.requestTransformers addObject:transformer];
+@end
+
+static inline BOOL PrestoIsJSONScalar(id value) {
+	return [value isKindOfClass:[NSNumber class]] || value == [NSNull null];
 }
 
-- (void)addGlobalResponseTransformer:(PrestoResponseTransformer)transformer {
-//	[self addResponseTransformer:transformer forClass:[NSObject class]];
-	[self.responseTransformers addObject:transformer];
+// a field's value as kept in loadedValues: objects Presto has loaded are kept as they are (and compared by identity), scalars too
+// strings and raw collections are kept as digests so they're caught even when mutated in place
+static id PrestoLoadedValue(id value) {
+	if (PrestoIsJSONScalar(value))
+		return value;
+	if ([value isKindOfClass:[NSString class]] || (([value isKindOfClass:[NSArray class]] || [value isKindOfClass:[NSDictionary class]]) && ![objc_getAssociatedObject(value, @selector(presto)) loadedValues]))
+		return @(PrestoDigestObject(value));
+	return value;
 }
 
-- (void)mapRemoteField:(NSString *)field toLocalProperty:(NSString *)property forClass:(Class)class {
-//	id<NSCopying> key = (id<NSCopying>)class ?: [NSNull null];
+// returns the positions in sequence that make up one longest strictly increasing subsequence
+static NSIndexSet *PrestoLongestIncreasingSubsequence(NSArray *sequence) {
+	NSUInteger count = sequence.count;
+	NSMutableIndexSet *result = [NSMutableIndexSet new];
+	if (!count)
+		return result;
 	
-	if (self.fieldToPropertyMappings[class] == nil) {
-		[(NSMutableDictionary *)_fieldToPropertyMappings setObject:[NSMutableDictionary new] forKey:(id<NSCopying>)class];
-	}
-	[(NSMutableDictionary *)self.fieldToPropertyMappings[class] setObject:property forKey:field];
+	NSUInteger *values = malloc(count * sizeof(NSUInteger));
+	NSUInteger *tails = malloc(count * sizeof(NSUInteger));
+	NSUInteger *previous = malloc(count * sizeof(NSUInteger));
+	NSUInteger length = 0;
 	
-	if (self.propertyToFieldMappings[class] == nil) {
-		[(NSMutableDictionary *)_propertyToFieldMappings setObject:[NSMutableDictionary new] forKey:(id<NSCopying>)class];
+	for (NSUInteger i = 0; i < count; i++) {
+		values[i] = [sequence[i] unsignedIntegerValue];
+		NSUInteger low = 0, high = length;
+		while (low < high) {
+			NSUInteger mid = (low + high) / 2;
+			if (values[tails[mid]] < values[i])
+				low = mid + 1;
+			else
+				high = mid;
+		}
+		previous[i] = low > 0 ? tails[low - 1] : NSNotFound;
+		tails[low] = i;
+		if (low == length)
+			length++;
 	}
-	[(NSMutableDictionary *)self.propertyToFieldMappings[class] setObject:field forKey:property];
+	
+	for (NSUInteger i = tails[length - 1]; i != NSNotFound; i = previous[i])
+		[result addIndex:i];
+	
+	free(values);
+	free(tails);
+	free(previous);
+	return result;
 }
 
-- (void)addSerializationKey:(NSString *)key forClass:(Class)class {
-	if (self.serializationKeys[class] == nil) {
-		[(NSMutableDictionary *)_serializationKeys setObject:[NSMutableSet new] forKey:(id<NSCopying>)class];
-	}
-	[(NSMutableSet *)_serializationKeys[class] addObject:key];
-}
+@interface PrestoArrayDiff ()
 
-- (void)addSerializationKeys:(NSArray *)keys forClass:(Class)class {
-	for (NSString *key in keys)
-		[self addSerializationKey:key forClass:class];
-}
+@property (readwrite, nonatomic) NSIndexSet *insertedIndexes;
+@property (readwrite, nonatomic) NSIndexSet *removedIndexes;
+@property (readwrite, nonatomic) NSIndexSet *updatedIndexes;
+@property (readwrite, nonatomic) NSArray *moves;
 
-#pragma mark -
+@end
 
-- (NSString *)propertyNameForField:(NSString *)fieldName forClass:(Class)class {
-	NSString *propertyName;
-	while (class != nil) {
-		NSDictionary *fieldToPropertyMappings = self.fieldToPropertyMappings[class];
-		if (fieldToPropertyMappings && fieldToPropertyMappings[fieldName] != nil)
-			propertyName = fieldToPropertyMappings[fieldName];
-		// should we break? does it make sense to keep going?
-		class = [class superclass];
-	}
-	return propertyName ?: fieldName;
-}
+@implementation PrestoArrayDiff
 
-- (NSString *)fieldNameForProperty:(NSString *)propertyName forClass:(Class)class {
-	NSString *fieldName;
-	while (class != nil) {
-		NSDictionary *propertyToFieldMappings = self.propertyToFieldMappings[class];
-		if (propertyToFieldMappings && propertyToFieldMappings[propertyName] != nil)
-			fieldName = propertyToFieldMappings[propertyName];
-		// should we break? does it make sense to keep going?
-		class = [class superclass];
-	}
-	return fieldName ?: propertyName;
+- (BOOL)hasChanges {
+	return self.insertedIndexes.count || self.removedIndexes.count || self.updatedIndexes.count || self.moves.count;
 }
 
-- (BOOL)shouldPropertyBeSerialized:(NSString *)propertyName forClass:(Class)class {
-	NSArray* ignoreKeys = @[@"superclass", @"hash", @"debugDescription"]; // never serialize these
-	
-	if ([ignoreKeys containsObject:propertyName])
-		return NO;
-	
-	NSMutableSet *serializationKeys = self.serializationKeys[class];
-	
-	if (!serializationKeys || [serializationKeys containsObject:propertyName])
-		return YES;
-	else
-		return NO;
+- (NSString *)description {
+	return [NSString stringWithFormat:@"<PrestoArrayDiff inserted: %lu removed: %lu updated: %lu moved: %lu>", (unsigned long)self.insertedIndexes.count, (unsigned long)self.removedIndexes.count, (unsigned long)self.updatedIndexes.count, (unsigned long)self.moves.count];
 }
 
-#pragma mark -
+@end
 
-- (void)warnProperty:(NSString *)propertyName forClass:(Class)class valueClass:(Class)valueClass {
-	if (!LOG_WARNINGS)
-		return;
-	
-	if (self.warnedKeys[class] == nil) {
-		self.warnedKeys[(id<NSCopying>)class] = [NSMutableSet new];
-	}
-	
-	if (![self.warnedKeys[class] containsObject:propertyName]) {
-		PRLog(@"pRESTo Warning: Property ‘%@’ (%@) not found in class %@.", propertyName, valueClass, class);
-		[self.warnedKeys[class] addObject:propertyName];
-	}
+#pragma mark - PrestoRequestMetrics
+
+@implementation PrestoRequestMetrics
+
+- (NSString *)description {
+	return [NSString stringWithFormat:@"<PrestoRequestMetrics %d %@ %@ queue: %.1fms network: %.1fms parse: %.1fms transform: %.1fms bind: %.1fms diff: %.1fms callbacks: %.1fms sent: %lu received: %lu instantiated: %lu reused: %lu>", (int)self.statusCode, self.request.HTTPMethod, self.request.URL.absoluteString, self.queueWait * 1000, self.network * 1000, self.parse * 1000, self.transform * 1000, self.bind * 1000, self.diff * 1000, self.callbackDispatch * 1000, (unsigned long)self.requestBytes, (unsigned long)self.responseBytes, (unsigned long)self.objectsInstantiated, (unsigned long)self.objectsReused];
 }
 
 @end
@@ -397,6 +3356,16 @@ static id ValueForUndefinedKey;
 
 #pragma mark - PrestoSource
 
+@interface PrestoSource ()
+
+@property (strong, nonatomic) id responseObject; // a streamed response waiting to be bound
+@property (strong, nonatomic) NSData *responseData; // a buffered response waiting to be decoded (lastPayload is only kept if retained)
+@property (strong, nonatomic) NSString *responseContentType; // of the last response, to pick the codec it is decoded with
+
+- (NSString *)cacheKey;
+
+@end
+
 @implementation PrestoSource
 
 + (instancetype)sourceWithURL:(NSURL *)url method:(NSString *)method payload:(id)payload {
@@ -460,6 +3429,22 @@ static id ValueForUndefinedKey;
 	return self.isLoaded || self.error ;//|| self.statusCode != 200;
 }
 
+// the identity of this source in the response cache; only GETs without a payload are cached
+- (NSString *)cacheKey {
+	if ((self.method && ![self.method isEqualToString:@"GET"]) || self.payload || self.payloadData || !self.url)
+		return nil;
+	return [NSString stringWithFormat:@"GET %@", self.url.absoluteString];
+}
+
+// header names are case-insensitive, but allHeaderFields keeps whatever case the server sent
++ (NSString *)valueForHeader:(NSString *)header inResponse:(NSHTTPURLResponse *)response {
+	for (NSString *key in response.allHeaderFields) {
+		if ([key caseInsensitiveCompare:header] == NSOrderedSame)
+			return response.allHeaderFields[key];
+	}
+	return nil;
+}
+
 - (void)setError:(NSError *)error {
 	_error = error;
 	
@@ -470,16 +3455,7 @@ static id ValueForUndefinedKey;
 - (void)setRefreshInterval:(NSTimeInterval)refreshInterval {
 	_refreshInterval = refreshInterval;
 	
-	if (_refreshInterval != INFINITY && _refreshInterval != 0) { // both 0 and INFINITY mean never
-		__block __weak typeof(self) weakSelf = self;
-		dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.refreshInterval * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
-			typeof(weakSelf) strongSelf = weakSelf;
-			if (strongSelf) {
-				[strongSelf.target reload]; // verify .target
-				strongSelf.refreshInterval = strongSelf.refreshInterval; // queue next refresh
-			}
-		});
-	}
+	[self.target.manager scheduleRefreshOf:self.target interval:refreshInterval];
 }
 
 #pragma mark -
@@ -529,12 +3505,6 @@ static id ValueForUndefinedKey;
 
 #pragma mark - PrestoMetadata
 
-@interface PrestoMetadata ()
-
-@property (weak, nonatomic) id weakTarget;
-
-@end
-
 @implementation PrestoMetadata
 
 - (instancetype)init {
@@ -542,6 +3512,7 @@ static id ValueForUndefinedKey;
 	if (self) {
 		// NOTE: keep this constructor as lightweight as possible as metadata instances may be created often
 		self.manager = [Presto defaultInstance];
+		_priority = NSURLSessionTaskPriorityDefault;
 	}
 	return self;
 }
@@ -592,6 +3563,8 @@ static id ValueForUndefinedKey;
 	source.target = self;
 	_source = source;
 	
+	[self.manager scheduleRefreshOf:self interval:source.refreshInterval]; // the interval may have been set before the source was attached
+	
 	[self invalidate];
 }
 
@@ -603,10 +3576,21 @@ static id ValueForUndefinedKey;
 	self.source.refreshInterval = refreshInterval;
 }
 
-- (NSMutableArray *)callbacks {
-	if (_callbacks == nil)
-		_callbacks = [NSMutableArray new];
-	return _callbacks;
+// ordered sets so records are called in the order they were added, but can be removed in constant time
+- (NSMutableOrderedSet *)completions {
+	if (_completions == nil)
+		_completions = [NSMutableOrderedSet new];
+	return _completions;
+}
+
+- (NSMutableOrderedSet *)dependencies {
+	if (_dependencies == nil)
+		_dependencies = [NSMutableOrderedSet new];
+	return _dependencies;
+}
+
+- (NSArray *)callbacks {
+	return [self.completions.array arrayByAddingObjectsFromArray:self.dependencies.array];
 }
 
 - (NSString *)lastResponseString {
@@ -618,7 +3602,7 @@ static id ValueForUndefinedKey;
 
 - (id)lastResponseObject {
 	if (self.source.lastPayload)
-		return [NSJSONSerialization JSONObjectWithData:self.source.lastPayload options:NSJSONReadingMutableContainers error:nil] ?: [[NSString alloc] initWithData:self.source.lastPayload encoding:NSUTF8StringEncoding];
+		return [self objectWithPayload:self.source.lastPayload];
 	else
 		return nil;
 }
@@ -656,6 +3640,41 @@ static id ValueForUndefinedKey;
 	return self;
 }
 
+- (PrestoMetadata *)withCodec:(id<PrestoCodec>)codec {
+	self.source.codec = codec;
+	return self;
+}
+
+- (PrestoMetadata *)withCompressedPayload {
+	self.source.compressesPayload = YES;
+	return self;
+}
+
+- (id<PrestoCodec>)codec {
+	return self.source.codec ?: self.manager.defaultCodec;
+}
+
+// decodes with the codec registered for the response's content type, or our own if it doesn't have one we know
+// anything that can't be decoded is kept as a string, as it's most likely an error message
+- (id)objectWithPayload:(NSData *)data {
+	return [self objectWithPayload:data contentType:self.source.responseContentType];
+}
+
+- (id)objectWithPayload:(NSData *)data contentType:(NSString *)contentType {
+	id<PrestoCodec> codec = [self.manager codecForContentType:contentType] ?: self.codec;
+	return [codec objectWithData:data] ?: [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+}
+
+- (PrestoMetadata *)withStreamedResponse {
+	self.streamsResponse = YES;
+	return self;
+}
+
+- (PrestoMetadata *)withPriority:(float)priority {
+	self.priority = priority;
+	return self;
+}
+
 - (PrestoMetadata *)withTemplate:(NSString *)jsonTemplate {
 	self.source.serializationTemplate = [NSJSONSerialization JSONObjectWithData:[jsonTemplate dataUsingEncoding:NSUTF8StringEncoding] options:0 error:nil];
 	// TODO: add error handling
@@ -691,6 +3710,7 @@ static id ValueForUndefinedKey;
 
 - (PrestoMetadata *)getFromURL:(NSURL *)url {
 	self.source = [PrestoSource sourceWithURL:url method:@"GET" payload:nil];
+	// the cache is bound by load:, once withClass:, withCodec: and the like have been applied
 	return self;
 }
 
@@ -727,6 +3747,41 @@ static id ValueForUndefinedKey;
 	return [[self postToURL:self.source.url] reload]; // puts and posts don't need an observer to load
 }
 
+- (PrestoMetadata *)patchSelf {
+	NSArray *changedFields = [self changedFields];
+	if (!changedFields.count) {
+		if (LOG_VERBOSE)
+			PRLog(@"Presto: Nothing to patch for %@.", self.source.url.absoluteString);
+		return nil;
+	}
+	
+	NSDictionary *sentDigests = [self currentFieldDigests];
+	PrestoMetadata *result = [PrestoMetadata new];
+	PrestoSource *source = [PrestoSource sourceWithURL:self.source.url method:@"PATCH" payload:nil];
+	// a template of just the changed fields, in the codec the body will be labelled with
+	id<PrestoCodec> codec = self.codec;
+	source.codec = codec;
+	if ([codec isKindOfClass:[PrestoJSONCodec class]])
+		source.payloadData = [self toJSONDataWithTemplate:changedFields];
+	else
+		source.payloadData = [codec dataWithObject:[self toJSONObjectWithTemplate:changedFields]];
+	result.source = source;
+	
+	__weak typeof(self) weakSelf = self;
+	[[result reload] onComplete:^(NSObject *_) {
+		// the server has what we sent now, so those fields are no longer changed
+		typeof(self) strongSelf = weakSelf;
+		if (!strongSelf.tracksChanges)
+			return;
+		NSMutableDictionary *fieldDigests = [strongSelf.fieldDigests mutableCopy] ?: [NSMutableDictionary new];
+		for (NSString *field in changedFields)
+			fieldDigests[field] = sentDigests[field];
+		strongSelf.fieldDigests = fieldDigests;
+	} failure:^(NSObject *_) {}];
+	
+	return result;
+}
+
 - (PrestoMetadata *)deleteSelf {
 	return [[self deleteFromURL:self.source.url] reload];
 }
@@ -746,10 +3801,137 @@ static id ValueForUndefinedKey;
 		return nil;
 	}
 	
-	PrestoMetadata *result = [self loadWithObject:source];
-	result.append = YES; // is it safe to set this *after* the above call? if it's guaranteed to be decoupled then yes
+	// the other object keeps its source; its response is appended to our target instead of loading into it
+	[self loadPage:source.presto];
 	
-	return result;
+	return self;
+}
+
+#pragma mark - Pagination
+
+- (PrestoMetadata *)withPagination:(PrestoPageExtractor)extractor {
+	self.nextPageExtractor = extractor;
+	return self;
+}
+
+- (PrestoMetadata *)withNextPageField:(NSString *)keyPath {
+	return [self withPagination:^NSURL *(id responseObject, NSURL *pageURL) {
+		id next = [responseObject isKindOfClass:[NSDictionary class]] ? [responseObject valueForKeyPath:keyPath] : nil;
+		if (![next isKindOfClass:[NSString class]] || ![next length])
+			return nil;
+		return [NSURL URLWithString:next relativeToURL:pageURL].absoluteURL;
+	}];
+}
+
+- (PrestoMetadata *)withCursorField:(NSString *)keyPath parameter:(NSString *)parameter {
+	__weak typeof(self) weakSelf = self;
+	return [self withPagination:^NSURL *(id responseObject, NSURL *pageURL) {
+		id cursor = [responseObject isKindOfClass:[NSDictionary class]] ? [responseObject valueForKeyPath:keyPath] : nil;
+		if (!cursor || cursor == [NSNull null] || ([cursor isKindOfClass:[NSString class]] && ![cursor length]))
+			return nil;
+		
+		// every page is the first page's url with the cursor swapped in
+		NSURLComponents *components = [NSURLComponents componentsWithURL:weakSelf.source.url ?: pageURL resolvingAgainstBaseURL:YES];
+		NSMutableArray *queryItems = [NSMutableArray new];
+		for (NSURLQueryItem *item in components.queryItems) {
+			if (![item.name isEqualToString:parameter])
+				[queryItems addObject:item];
+		}
+		[queryItems addObject:[NSURLQueryItem queryItemWithName:parameter value:[cursor description]]];
+		components.queryItems = queryItems;
+		return components.URL;
+	}];
+}
+
+- (PrestoMetadata *)withPrefetchDistance:(NSUInteger)distance {
+	self.prefetchDistance = distance;
+	return self;
+}
+
+- (BOOL)hasMorePages {
+	return self.nextPageURL != nil;
+}
+
+- (BOOL)isLoadingPage {
+	return self.loadingPage != nil;
+}
+
+- (PrestoMetadata *)loadNextPage {
+	NSURL *url;
+	@synchronized (self) {
+		url = self.nextPageURL;
+		if (!url || self.loadingPage)
+			return nil; // nothing more to load, or already on its way
+	}
+	
+	PrestoMetadata *page = [PrestoMetadata new];
+	page.source = [PrestoSource sourceWithURL:url method:@"GET" payload:nil];
+	return [self loadPage:page] ? page : nil;
+}
+
+// loads page and appends its response to our target
+- (BOOL)loadPage:(PrestoMetadata *)page {
+	@synchronized (self) {
+		if (self.loadingPage)
+			return NO;
+		self.loadingPage = page; // keeps the page alive while it loads
+	}
+	
+	page.pagedMetadata = self;
+	page.manager = self.manager;
+	page.nativeClass = self.nativeClass;
+	page.classDepth = self.classDepth;
+	page.priority = self.priority;
+	
+	__weak typeof(self) weakSelf = self;
+	PrestoCallback finished = ^(NSObject *_) {
+		typeof(self) strongSelf = weakSelf;
+		@synchronized (strongSelf) {
+			if (strongSelf.loadingPage == page)
+				strongSelf.loadingPage = nil;
+		}
+		page.pagedMetadata = nil; // an object given to appendFrom: loads normally again from here on
+	};
+	[[page reload] onComplete:finished failure:finished];
+	
+	return YES;
+}
+
+// a page loads into the collection it belongs to rather than a target of its own
+- (BOOL)loadPageWithJSONObject:(id)jsonObject {
+	PrestoMetadata *collection = self.pagedMetadata;
+	
+	if (self.hasDecodedPage) {
+		self.hasDecodedPage = NO;
+		collection.nextPageURL = self.decodedNextPageURL;
+	}
+	
+	if (![jsonObject isKindOfClass:[NSArray class]]) {
+		if (LOG_ERRORS)
+			PRLog(@"pRESTo Error: Unsupported JSON object (%@) in page %@; pages must be arrays.", [jsonObject class], self.source.url.absoluteString);
+		return NO;
+	}
+	
+	// appended after everything we have, with any elements we already have loaded in place
+	BOOL changed = [collection loadWithArray:jsonObject inWindow:NSMakeRange([collection.target count], 0)];
+	
+	if (!self.loadedPageCount) {
+		self.loadedPageCount = 1; // a cached page and its revalidation only count once
+		collection.loadedPageCount = MAX(collection.loadedPageCount, 1) + 1;
+	}
+	
+	self.loadChanged = changed;
+	[self callSuccessBlocks:changed];
+	
+	return changed;
+}
+
+- (void)didConsumeElementAtIndex:(NSUInteger)index {
+	if (!self.prefetchDistance || !self.nextPageURL || self.loadingPage)
+		return;
+	
+	if (index + self.prefetchDistance >= [self.target count])
+		[self loadNextPage];
 }
 
 #pragma mark -
@@ -765,10 +3947,10 @@ static id ValueForUndefinedKey;
 	
 	// if there are any observers, load the object immediately
 	// TODO: should we skip this if deferLoad is true??
-	if (self.callbacks.count/* self.completions.count || self.dependencies.count*/) {
+	if (_completions.count || _dependencies.count) {
 		// this is wrapped in a dispatch_async so any further metadata configuration can happen on the current thread before it is kicked off
 		// (in fact perhaps all loads should be async??)
-		dispatch_async(dispatch_get_main_queue(), ^{
+		dispatch_async(self.manager.targetQueue, ^{
 			[self reload];
 		});
 	}
@@ -792,17 +3974,46 @@ static id ValueForUndefinedKey;
 	if (source.isLoading && !force)
 		return; // already loading
 	
-	[NSObject cancelPreviousPerformRequestsWithTarget:self]; // in case we've scheduled any re-tries, cancel them
+	[self.manager cancelRetryOf:self]; // in case we've scheduled a retry, this load replaces it
+	
+	self.requestMetrics = nil; // so binding the cache below doesn't report a previous request
+	self.deferredLoads = nil;
+	[self loadFromCache]; // binds the last known state (if any) before we revalidate it
 	
 	source.isLoading = YES;
+	if (self.manager.collectsMetrics)
+		self.requestMetrics = [PrestoRequestMetrics new]; // filled in as the request makes its way through the pipeline
 	source.request = [NSMutableURLRequest requestWithURL:source.url];
-	[source.request setValue:@"application/json" forHTTPHeaderField:@"Accept"];
-	[source.request setValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
+	
+	// we prefer our own codec but can decode JSON regardless (compressed responses are negotiated and inflated by NSURLSession)
+	id<PrestoCodec> codec = self.codec;
+	BOOL isJSON = [codec isKindOfClass:[PrestoJSONCodec class]];
+	[source.request setValue:isJSON ? codec.contentType : [NSString stringWithFormat:@"%@, application/json;q=0.9", codec.contentType] forHTTPHeaderField:@"Accept"];
+	[source.request setValue:codec.contentType forHTTPHeaderField:@"Content-Type"];
+	
+	// revalidate against the last response rather than downloading it again (applied before the transformers so they can override it)
+	if (!source.method || [source.method isEqualToString:@"GET"]) {
+		if (source.entityTag)
+			[source.request setValue:source.entityTag forHTTPHeaderField:@"If-None-Match"];
+		if (source.lastModified)
+			[source.request setValue:source.lastModified forHTTPHeaderField:@"If-Modified-Since"];
+	}
 	
 	if (source.method && ![source.method isEqualToString:@"GET"]) {
 		source.request.HTTPMethod = source.method;
 		PrestoMetadata *payloadMetadata = source.payload && [source.payload isKindOfClass:[PrestoMetadata class]] ? (PrestoMetadata *)source.payload : source.payload.presto;
-		source.request.HTTPBody = payloadMetadata ? [[payloadMetadata toJSONStringWithTemplate:source.serializationTemplate prettyPrinted:NO] dataUsingEncoding:NSUTF8StringEncoding] : source.payloadData;
+		NSData *body = source.payloadData;
+		if (payloadMetadata && isJSON)
+			body = [payloadMetadata toJSONDataWithTemplate:source.serializationTemplate]; // written directly, without the intermediate tree
+		else if (payloadMetadata)
+			body = [codec dataWithObject:[payloadMetadata toJSONObjectWithTemplate:source.serializationTemplate]];
+		
+		NSData *compressedBody = source.compressesPayload ? PrestoGzipData(body) : nil;
+		if (compressedBody.length) {
+			body = compressedBody;
+			[source.request setValue:@"gzip" forHTTPHeaderField:@"Content-Encoding"];
+		}
+		source.request.HTTPBody = body;
 	}
 	
 	[source transformRequest];
@@ -815,33 +4026,59 @@ static id ValueForUndefinedKey;
 	}
 
 	if (LOG_PAYLOADS)
-		PRLog(@"▶ %@ %@%@%@", source.request.HTTPMethod, source.request.URL.absoluteString, requestHeaders, source.payload || source.payloadData ? [NSString stringWithFormat:@"\n%@", [[NSString alloc] initWithData:source.request.HTTPBody encoding:NSUTF8StringEncoding]] : @"");
+		PRLog(@"▶ %@ %@%@%@", source.request.HTTPMethod, source.request.URL.absoluteString, requestHeaders, source.payload || source.payloadData ? [NSString stringWithFormat:@"\n%@", PrestoPayloadDescription(source.request.HTTPBody)] : @"");
 	
 	__weak __block typeof(self) weakSelf = self;
+	Presto *manager = self.manager;
 	
-	self.manager.activeRequests++;
+	[manager adjustActiveRequests:1];
 	
-	// i should really consider rewriting this to use NSURLConnection objects
-//	NSURLConnection* connection = [NSURLConnection connectionWithRequest:request delegate:self];
-	// TODO: set source.connection?
-	[[[NSURLSession sharedSession] dataTaskWithRequest:source.request completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable connectionError) {
-		
-//	}];
-//	[NSURLConnection sendAsynchronousRequest:source.request queue:[NSOperationQueue mainQueue] completionHandler:^(NSURLResponse *response, NSData *data, NSError *connectionError) {
+	// streamed responses arrive already decoded (jsonObject) with a digest in place of the payload; buffered responses arrive as data
+	PrestoResponseHandler handleResponse = ^(id jsonObject, NSData *data, NSNumber *digest, NSURLResponse *response, NSError *connectionError) {
 		__strong typeof(weakSelf) strongSelf = weakSelf;
 //		__strong id strongTarget = strongSelf.target;
 		
-		strongSelf.manager.activeRequests--; // FIXME: (nonurgent) this can technically not be called if weakSelf disappears, leaving activeRequests in an incorrect state
-			
-		BOOL changed = !source.lastPayload || ![data isEqualToData:source.lastPayload];
+		[manager adjustActiveRequests:-1];
+		
+		if ([connectionError.domain isEqualToString:NSURLErrorDomain] && connectionError.code == NSURLErrorCancelled) {
+			if (LOG_ZOMBIES)
+				PRLog(@"Presto: Request for %@ was cancelled; nothing is waiting on it anymore.", source.url.absoluteString);
+			source.isLoading = NO;
+			strongSelf.requestMetrics = nil;
+			return;
+		}
+		
+		NSHTTPURLResponse *httpResponse = [response isKindOfClass:[NSHTTPURLResponse class]] ? (NSHTTPURLResponse *)response : nil;
+		BOOL notModified = !connectionError && httpResponse.statusCode == 304; // the payload we already have is still current
+		
+		if (!digest && data)
+			digest = @(PrestoDigestBytes(PrestoDigestSeed, data.bytes, data.length));
+		BOOL changed = notModified ? NO : !source.lastPayloadDigest || ![digest isEqualToNumber:source.lastPayloadDigest];
 		// TODO: we should consider dropping this changed flag entirely, because it's quite possible that the client state could have changed and we need to reset it to the server state even if the server state has not itself actually changed
 		
 		source.isLoading = NO; // works better up here in case any of the callbacks register further callbacks
 		source.error = connectionError;
-		source.statusCode = ((NSHTTPURLResponse*)response).statusCode;
-		source.lastPayload = data;
+		source.statusCode = httpResponse.statusCode;
+		
+		if (!notModified) {
+			// only the digest is needed to detect changes, so successful bodies are only held onto if asked to
+			BOOL retained = data.length && (httpResponse.statusCode != 200 || data.length <= manager.payloadRetentionLimit);
+			source.lastPayload = retained ? data : nil;
+			source.lastPayloadDigest = digest;
+			source.responseData = data;
+			source.responseObject = jsonObject;
+			source.responseContentType = httpResponse.MIMEType;
+		}
+		
+		if (!connectionError && httpResponse.statusCode == 200) {
+			source.entityTag = [PrestoSource valueForHeader:@"ETag" inResponse:httpResponse];
+			source.lastModified = [PrestoSource valueForHeader:@"Last-Modified" inResponse:httpResponse];
+			
+			if (changed && data.length)
+				[manager.responseCache storePayload:data entityTag:source.entityTag lastModified:source.lastModified contentType:source.responseContentType forKey:source.cacheKey];
+		}
 		
-		if (!source.error && source.statusCode != 200) // what about statusCode == 0?
+		if (!source.error && source.statusCode != 200 && !notModified) // what about statusCode == 0?
 			source.error = [NSError errorWithDomain:@"PrestoErrorDomain" code:source.statusCode userInfo:@{NSLocalizedDescriptionKey:[NSHTTPURLResponse localizedStringForStatusCode:source.statusCode]}]; // TODO: improve this
 		
 		// this is apparently how NSURLConnection reports 401? (lame)
@@ -860,8 +4097,8 @@ static id ValueForUndefinedKey;
 			}];
 		}
 		
-		NSString* jsonString = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
 		if (LOG_PAYLOADS) {
+			NSString* jsonString = data ? PrestoPayloadDescription(data) : @"(streamed)";
 			PRLog(@"◀ %d %@ %@%@\n%@", (int)source.statusCode, source.request.HTTPMethod, source.url.absoluteString, responseHeaders, jsonString);
 		}
 		
@@ -873,7 +4110,7 @@ static id ValueForUndefinedKey;
 //			return; // object has disappeared
 		}
 		
-		if (source.error || source.statusCode != 200) {
+		if (source.error || (source.statusCode != 200 && !notModified)) {
 			// TODO: add more error codes
 			if (connectionError.code == kCFURLErrorNotConnectedToInternet
 					|| connectionError.code == kCFURLErrorCannotConnectToHost
@@ -890,49 +4127,208 @@ static id ValueForUndefinedKey;
 				// perhaps we should set the timeout to something less than 60 seconds by default
 				// or at least allow this to be customized. (we may have to switch to NSURLConnection)
 				source.error = nil; // we don't want this hanging around
-				[weakSelf performSelector:@selector(load:) withObject:@YES afterDelay:2.0];
+				source.responseData = nil; // nor the body, which is never decoded
+				source.responseObject = nil;
+				strongSelf.requestMetrics = nil; // the retry is measured on its own
+				[manager scheduleRetryOf:strongSelf]; // backs off and is jittered so we don't all come back at once
 //				dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(2.0 * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
 //					[strongSelf load:YES];
 //				});
 				return;
 			}
-			[strongSelf loadResponse];
-			[strongSelf callFailureBlocks:YES]; // fix this parameter?
+			[manager recordLoadOf:strongSelf succeeded:NO];
+			[strongSelf loadResponseWithCompletion:^{
+				[strongSelf callFailureBlocks:YES]; // fix this parameter?
+			}];
 		} else {
+			[manager recordLoadOf:strongSelf succeeded:YES];
 			if (changed)
-				[self loadResponse];
+				[self loadResponseWithCompletion:nil];
+			else {
+				// loaded, unchanged: refresh the loaded time and complete, but don't bother the dependencies
+				source.isLoaded = YES;
+				source.responseData = nil; // decoding is what normally lets go of these
+				source.responseObject = nil;
+				NSArray *deferredLoads = strongSelf.deferredLoads; // the instances may have changed since, even if this payload hasn't
+				strongSelf.deferredLoads = nil;
+				dispatch_group_notify(strongSelf.decodeGroup, manager.targetQueue, ^{ // after the cached state it confirms has been bound
+					for (dispatch_block_t load in deferredLoads)
+						load();
+					strongSelf.isStale = NO; // the cached state was confirmed
+					[strongSelf callSuccessBlocks:NO];
+				});
+			}
 //			[strongSelf callSuccessBlocks:changed includeCompletions:YES];
 		}
 		
-//		if (!source.error && source.statusCode == 200) {
-//		}
-		if (source.isLoading)
-			NSAssert(!source.isLoading, @"source should not be loading here!");
+//		if (!source.error && source.statusCode == 200) {
+//		}
+		if (source.isLoading)
+			NSAssert(!source.isLoading, @"source should not be loading here!");
+		
+//		if (!source.targetProperty) {
+//		if (changed && [strongTarget respondsToSelector:@selector(objectDidLoad)]) {
+//			[strongTarget objectDidLoad];
+//		}
+//		}
+	};
+	
+	if (self.streamsResponse && isJSON) { // the stream parser only speaks JSON
+		// response transformers need the whole decoded payload, so native classes can only be bound during parsing without them
+		BOOL transformed = source.responseTransformers.count || self.manager.responseTransformers.count;
+		[manager streamRequest:source.request forMetadata:self bindingClass:transformed || self.materializesTargetLazily ? nil : self.nativeClass atDepth:self.classDepth completion:handleResponse];
+	} else {
+		[manager performRequest:source.request forMetadata:self completion:handleResponse];
+	}
+}
+
+- (void)loadResponse {
+	PrestoSource *source = self.source;
+	BOOL succeeded = !source.error && source.statusCode == 200;
+	PrestoRequestMetrics *metrics = self.requestMetrics;
+	NSArray *deferredLoads = self.deferredLoads;
+	self.deferredLoads = nil;
+	
+	PrestoLoadContext *context = [PrestoLoadContext contextWithMetrics:metrics deferredLoads:nil]; // already on the target queue
+	id jsonObject = [self decodeResponseWithContext:context];
+	self.loadContext = context;
+	[self commitResponse:jsonObject succeeded:succeeded fromCache:NO afterLoads:deferredLoads measuringInto:metrics];
+	self.loadContext = nil;
+}
+
+// decodes off the target queue, then commits onto the live target on it
+- (void)loadResponseWithCompletion:(void (^)(void))completion {
+	[self loadResponseFromCache:NO completion:completion];
+}
+
+// the response is taken off the source up front, so one arriving in the meantime can't be swapped in underneath the decode
+// responses are committed in the order they were handed over; one that finishes decoding after a newer one has been committed is dropped
+- (void)loadResponseFromCache:(BOOL)fromCache completion:(void (^)(void))completion {
+	Presto *manager = self.manager;
+	PrestoSource *source = self.source;
+	
+	id responseObject = source.responseObject;
+	NSData *data = source.responseData;
+	source.responseObject = nil; // streamed responses are only held until they are bound
+	source.responseData = nil; // the raw body isn't needed once decoded
+	NSString *contentType = source.responseContentType;
+	BOOL succeeded = !source.error && source.statusCode == 200;
+	
+	PrestoRequestMetrics *metrics = fromCache ? nil : self.requestMetrics;
+	NSMutableArray *deferredLoads = (fromCache ? nil : self.deferredLoads) ?: [NSMutableArray new];
+	if (!fromCache)
+		self.deferredLoads = nil;
+	
+	NSUInteger generation = ++self.responseGeneration;
+	dispatch_group_t decodeGroup = self.decodeGroup;
+	dispatch_group_enter(decodeGroup);
+	
+	dispatch_async(manager.decodeQueue, ^{
+		PrestoLoadContext *context = [PrestoLoadContext contextWithMetrics:metrics deferredLoads:deferredLoads];
+		id jsonObject = [self decodeObject:responseObject data:data contentType:contentType succeeded:succeeded context:context];
+		
+		dispatch_async(manager.targetQueue, ^{
+			if (generation > self.committedGeneration) {
+				self.committedGeneration = generation;
+				self.loadContext = [PrestoLoadContext contextWithMetrics:metrics deferredLoads:nil]; // anything found now is loaded right away
+				[self commitResponse:jsonObject succeeded:succeeded fromCache:fromCache afterLoads:deferredLoads measuringInto:metrics];
+				self.loadContext = nil;
+			} else if (LOG_VERBOSE) {
+				PRLog(@"Presto: Dropping a response for %@ that was superseded while it was being decoded.", source.url.absoluteString);
+			}
+			
+			if (completion)
+				completion();
+			dispatch_group_leave(decodeGroup);
+		});
+	});
+}
+
+- (dispatch_group_t)decodeGroup {
+	@synchronized (self) {
+		if (_decodeGroup == nil)
+			_decodeGroup = dispatch_group_create();
+		return _decodeGroup;
+	}
+}
+
+// registered instances found while decoding are loaded in place first, so the target sees them as they are now when it's reconciled
+- (void)commitResponse:(id)jsonObject succeeded:(BOOL)succeeded fromCache:(BOOL)fromCache afterLoads:(NSArray *)deferredLoads measuringInto:(PrestoRequestMetrics *)metrics {
+	NSTimeInterval start = metrics ? [NSDate timeIntervalSinceReferenceDate] : 0;
+	NSTimeInterval diff = metrics.diff;
+	
+	for (dispatch_block_t load in deferredLoads)
+		load();
+	[self commitResponse:jsonObject succeeded:succeeded fromCache:fromCache];
+	
+	if (metrics)
+		metrics.bind += [NSDate timeIntervalSinceReferenceDate] - start - (metrics.diff - diff); // diff is reported on its own
+}
+
+- (id)decodeResponseWithContext:(PrestoLoadContext *)context {
+	PrestoSource *source = self.source;
+	id responseObject = source.responseObject;
+	NSData *data = source.responseData;
+	source.responseObject = nil; // streamed responses are only held until they are bound
+	source.responseData = nil; // the raw body isn't needed once decoded
+	
+	return [self decodeObject:responseObject data:data contentType:source.responseContentType succeeded:!source.error && source.statusCode == 200 context:context];
+}
+
+// parses, transforms and constructs any native objects below the target, without touching the target itself
+- (id)decodeObject:(id)jsonObject data:(NSData *)data contentType:(NSString *)contentType succeeded:(BOOL)succeeded context:(PrestoLoadContext *)context {
+	PrestoRequestMetrics *metrics = context.metrics;
+	NSTimeInterval start = metrics ? [NSDate timeIntervalSinceReferenceDate] : 0;
+	
+	if (!jsonObject) {
+		if (!data.length)
+			return nil; // nothing to load
+		
+		jsonObject = [self objectWithPayload:data contentType:contentType];
+		if (metrics) {
+			metrics.parse += [NSDate timeIntervalSinceReferenceDate] - start;
+			start = [NSDate timeIntervalSinceReferenceDate];
+		}
+	}
+	
+	if (jsonObject && succeeded) {
+		// the page links usually sit in an envelope that the transformers strip, so they're read first
+		PrestoPageExtractor extractor = (self.pagedMetadata ?: self).nextPageExtractor;
+		if (extractor) {
+			self.decodedNextPageURL = extractor(jsonObject, self.source.url);
+			self.hasDecodedPage = YES;
+		}
+		
+		jsonObject = [self.source transformResponse:jsonObject]; // or do we want to store jsonObject on the response and just call [transformResponse]?
+		if (metrics) {
+			metrics.transform += [NSDate timeIntervalSinceReferenceDate] - start;
+			start = [NSDate timeIntervalSinceReferenceDate];
+		}
 		
-//		if (!source.targetProperty) {
-//		if (changed && [strongTarget respondsToSelector:@selector(objectDidLoad)]) {
-//			[strongTarget objectDidLoad];
-//		}
-//		}
-	}] resume];
+		// elements that are already instances are skipped when the target loads, so this does the construction work up front
+		if (self.nativeClass && self.classDepth > 0 && !self.materializesTargetLazily && ([jsonObject isKindOfClass:[NSMutableArray class]] || [jsonObject isKindOfClass:[NSMutableDictionary class]])) {
+			[self.manager processJSONObject:jsonObject forClass:self.nativeClass depth:self.classDepth context:context];
+			if (metrics)
+				metrics.bind += [NSDate timeIntervalSinceReferenceDate] - start;
+		}
+	}
+	
+	return jsonObject;
 }
 
-- (void)loadResponse {
-	if (!self.source.lastPayload || !self.source.lastPayload.length)
-		return; // nothing to load
-	
-	id jsonObject = [self lastResponseObject];
-	
+- (void)commitResponse:(id)jsonObject succeeded:(BOOL)succeeded fromCache:(BOOL)fromCache {
 	// not sure if this is the best place for this
-	if (self.manager.connectionDropped) {
+	if (!fromCache && self.manager.connectionDropped) {
 		self.manager.connectionDropped = NO;
 		if ([self.manager.delegate respondsToSelector:@selector(connectionEstablished)])
 			[self.manager.delegate connectionEstablished];
 	}
 	
 	if (jsonObject) {
-		if (!self.source.error && self.source.statusCode == 200) {
-			jsonObject = [self.source transformResponse:jsonObject]; // or do we want to store jsonObject on the response and just call [transformResponse]?
+		if (fromCache) {
+			[self loadWithJSONObject:jsonObject]; // stays stale unless the server has confirmed it in the meantime
+		} else if (succeeded) {
+			self.isStale = NO;
 			[self loadWithJSONObject:jsonObject];
 			self.source.isLoaded = YES;
 			
@@ -942,13 +4338,45 @@ static id ValueForUndefinedKey;
 			id errorResponse = jsonObject;
 			Class errorClass = self.errorClass ?: self.manager.defaultErrorClass;
 			if (errorClass && [jsonObject isKindOfClass:[NSDictionary class]])
-				errorResponse = [self.manager instantiateClass:errorClass withDictionary:jsonObject];
+				errorResponse = [self.manager instantiateClass:errorClass withDictionary:jsonObject context:self.loadContext];
 			// TODO: add support for arrays using errorClass as the arrayClass
 			self.source.errorResponse = errorResponse;
 		}
 	}
 }
 
+// binds the cached response for our source, if there is one, and marks the target stale until the server confirms or replaces it
+// the cached validators are used by the next request, so an unchanged resource costs a 304
+- (BOOL)loadFromCache {
+	PrestoSource *source = self.source;
+	PrestoResponseCache *cache = self.manager.responseCache;
+	
+	if (!cache || source.isLoaded || source.lastPayloadDigest)
+		return NO; // already have something better than the cache
+	
+	NSString *key = source.cacheKey;
+	PrestoCacheEntry *entry = key ? [cache entryForKey:key] : nil;
+	if (!entry.payload.length)
+		return NO;
+	
+	if (LOG_VERBOSE)
+		PRLog(@"Presto: Loading %@ from cache (loaded %@).", source.url.absoluteString, entry.loadedTime);
+	
+	source.responseData = entry.payload;
+	source.lastPayloadDigest = @(PrestoDigestBytes(PrestoDigestSeed, entry.payload.bytes, entry.payload.length)); // so an unchanged 200 isn't bound twice
+	if (entry.payload.length <= self.manager.payloadRetentionLimit)
+		source.lastPayload = entry.payload;
+	source.entityTag = entry.entityTag;
+	source.lastModified = entry.lastModified;
+	source.responseContentType = entry.contentType; // decoded with the codec it was sent in
+	source.statusCode = 200;
+	
+	self.isStale = YES;
+	[self loadResponseFromCache:YES completion:nil]; // decoded and committed like any other response, ahead of the one we're about to request
+	
+	return YES;
+}
+
 - (BOOL)loadWithJSONString:(NSString *)json {
 	// should this set the lastPayload?
 	NSError* jsonError;
@@ -964,7 +4392,17 @@ static id ValueForUndefinedKey;
 //	if (!strongTarget)
 //		return; // disappeared--this doesn't really make sense anymore that we can create the new target
 
+	if (self.pagedMetadata)
+		return [self loadPageWithJSONObject:jsonObject];
+	
 	id strongTarget = self.target;
+	
+	if (self.hasDecodedPage) {
+		self.hasDecodedPage = NO;
+		if (self.loadedPageCount <= 1)
+			self.nextPageURL = self.decodedNextPageURL; // further pages keep their own cursor when the first page is refreshed
+		self.loadedPageCount = MAX(self.loadedPageCount, 1);
+	}
 		
 //	NSLog(@"strongSelf.arrayClass: %@", self.arrayClass);
 //	jsonObject = [self.manager transformResponse:jsonObject forClass:self.arrayClass ?: [strongTarget class]]; // improve this with a better response transformer associated with endpoint
@@ -1019,19 +4457,24 @@ static id ValueForUndefinedKey;
 	if (dictionary == nil)
 		return NO;
 	
-	if (self.nativeClass && self.classDepth > 0)
-		[self.manager processJSONObject:dictionary forClass:self.nativeClass depth:self.classDepth];
+	self.loadedDigest = nil; // see loadSubtree:
+	
+	BOOL lazy = self.materializesTargetLazily;
+	if (self.nativeClass && self.classDepth > 0 && !lazy)
+		[self.manager processJSONObject:dictionary forClass:self.nativeClass depth:self.classDepth context:self.loadContext];
 	
 	__strong id strongTarget = self.weakTarget;
 	
 	if (!strongTarget) {
 		if (self.nativeClass && self.classDepth == 0) {
-			strongTarget = [self.manager instantiateClass:self.nativeClass withDictionary:dictionary];
+			strongTarget = [self.manager instantiateClass:self.nativeClass withDictionary:dictionary context:self.loadContext];
 			
 			if ([strongTarget respondsToSelector:@selector(objectDidLoad)]) // try to unify this with below
 				[strongTarget objectDidLoad];
 			
 			return YES; // nothing more to do, we're fully loaded
+		} else if (lazy) {
+			strongTarget = [[PrestoLazyDictionary alloc] initWithElementClass:self.nativeClass manager:self.manager]; // filled in below
 		} else {
 			strongTarget = [NSMutableDictionary dictionaryWithDictionary:dictionary];
 		}
@@ -1052,12 +4495,19 @@ static id ValueForUndefinedKey;
 	if ([strongTarget isKindOfClass:[NSMutableDictionary class]]) {
 //		[(NSMutableDictionary *)strongTarget addEntriesFromDictionary:dictionary];
 //		changed = YES; // we have to assume this because addEntries doesn't tell us
+		PrestoLazyDictionary *lazyTarget = lazy ? strongTarget : nil;
 		for (NSString* key in dictionary) {
 			NSObject *value = [dictionary valueForKey:key];
-			NSObject *existing = [(NSMutableDictionary *)strongTarget valueForKey:key];
+			NSObject *existing = lazyTarget ? [lazyTarget rawObjectForKey:key] : [(NSMutableDictionary *)strongTarget valueForKey:key];
 
-			if (existing) {
-				changed = [existing.presto loadWithJSONObject:value] || changed;
+			if (existing && lazyTarget && [existing isKindOfClass:[NSDictionary class]]) {
+				// never read, so there's no instance to keep; just swap in the new element
+				if (![existing isEqual:value]) {
+					[lazyTarget setObject:value forKey:key];
+					changed = YES;
+				}
+			} else if (existing) {
+				changed = [self loadChild:existing withSubtree:value] || changed;
 			} else {
 				[(NSMutableDictionary *)strongTarget setObject:value forKey:key];
 				changed = YES;
@@ -1066,17 +4516,23 @@ static id ValueForUndefinedKey;
 //				[value.presto withClass:self.nativeClass atDepth:self.classDepth - 1];
 		}
 	} else { // assume we are a custom class (which means nativeClass is already applied)
+		PrestoClassDescriptor *classDescriptor = [self.manager descriptorForClass:[strongTarget class]];
+		
 		for (NSString* key in dictionary) { // does this need allKeys?
-			NSString *propertyName = [self.manager propertyNameForField:key forClass:[self.target class]];
-	//		Class class = [self.target class];
-	//		NSString* propertyName = [self propertyNameForFieldName:key];
-			id value = [dictionary valueForKey:key];
+			id value = [dictionary objectForKey:key];
+			PrestoPropertyDescriptor *property = [classDescriptor propertyForField:key];
 			
-			// TODO: improve this (is primarySource even safe?)
-	//		[self.primarySource.serializationKeys addObject:propertyName];
+			if (property == nil) {
+				if (LOG_WARNINGS)
+					[self.manager warnProperty:[self.manager propertyNameForField:key forClass:[strongTarget class]] forClass:[strongTarget class] valueClass:[value class]];
+				continue;
+			}
 			
-			changed = [self loadProperty:propertyName withObject:value] || changed;
+			changed = [self loadProperty:property withObject:value] || changed;
 		}
+		
+		if (self.tracksChanges)
+			self.fieldDigests = [self currentFieldDigests]; // the loaded state is the new baseline
 	}
 	
 	if ([strongTarget respondsToSelector:@selector(objectDidLoad)])
@@ -1088,87 +4544,193 @@ static id ValueForUndefinedKey;
 //	if (self.error != nil)
 //		NSAssert(self.error == nil, @"Error should be nil here!");
 //	self.error = nil;
+	self.loadChanged = changed;
 	[self callSuccessBlocks:changed];
 	
 	return changed;
 }
 
 - (BOOL)loadWithArray:(NSArray *)array {
+	NSUInteger count = [self.weakTarget count];
+	NSRange window = NSMakeRange(0, count); // the whole array
+	if (self.append)
+		window = NSMakeRange(count, 0); // nothing is replaced
+	else if (self.loadedPageCount > 1)
+		window = NSMakeRange(0, MIN(self.firstPageLength, count)); // just the first page, leaving the pages after it in place
+	
+	BOOL changed = [self loadWithArray:array inWindow:window];
+	if (!self.append && array)
+		self.firstPageLength = self.loadedWindowLength; // elements merged into later pages don't count
+	return changed;
+}
+
+// reconciles array against the elements of the target in window, leaving the rest in place
+// elements that match one outside the window are loaded where they are instead of being duplicated
+- (BOOL)loadWithArray:(NSArray *)array inWindow:(NSRange)window {
 	if (array == nil)
 		return NO;
 	
-	if (self.nativeClass && self.classDepth > 0)
-		[self.manager processJSONObject:array forClass:self.nativeClass depth:self.classDepth];
+	self.loadedDigest = nil; // see loadSubtree:
+	
+	BOOL lazy = self.materializesTargetLazily;
+	if (self.nativeClass && self.classDepth > 0 && !lazy)
+		[self.manager processJSONObject:array forClass:self.nativeClass depth:self.classDepth context:self.loadContext];
 	
 	__strong NSMutableArray *strongTarget = self.weakTarget;
 	
 	if (!strongTarget) {
-		strongTarget = [NSMutableArray new];
+		strongTarget = lazy ? [[PrestoLazyArray alloc] initWithElementClass:self.nativeClass manager:self.manager] : [NSMutableArray new];
 		self.weakTarget = strongTarget;
 	}
-	
-	BOOL changed = NO;
-//	NSMutableArray *strongTarget = self.target;
-	NSMutableArray *tempResult = [NSMutableArray arrayWithCapacity:array.count];
+	PrestoLazyArray *lazyTarget = lazy ? (PrestoLazyArray *)strongTarget : nil;
+	lazyTarget.metadata = self;
 	
 	NSAssert([strongTarget isKindOfClass:[NSMutableArray class]], @"Cannot call loadWithArray: on anything other than NSMutableArray.");
 	
 	if ([strongTarget respondsToSelector:@selector(objectWillLoad:)])
 		[(id)strongTarget objectWillLoad:array];
 	
-	int lastIndex = 0;
+	PrestoRequestMetrics *metrics = self.loadContext.metrics;
+	NSTimeInterval diffStart = metrics ? [NSDate timeIntervalSinceReferenceDate] : 0;
+	
+	// index the current contents by identity so each incoming element is matched in constant time
+	// duplicates are kept in order and matched first-come first-served
+	NSArray *current = lazyTarget ? [lazyTarget rawElements] : [strongTarget copy];
+	NSMapTable *existingIndexes = [NSMapTable strongToStrongObjectsMapTable];
+	NSUInteger existingCount = current.count;
+	window.location = MIN(window.location, existingCount);
+	window.length = MIN(window.length, existingCount - window.location);
+	for (NSUInteger i = 0; i < existingCount; i++) {
+		PrestoIdentity *identity = lazyTarget ? [self identityOfLazyElement:current[i]] : [PrestoIdentity identityOf:current[i]];
+		NSMutableArray *indexes = [existingIndexes objectForKey:identity];
+		if (!indexes) {
+			indexes = [NSMutableArray new];
+			[existingIndexes setObject:indexes forKey:identity];
+		}
+		[indexes addObject:@(i)];
+	}
+	
+	if (metrics)
+		metrics.diff += [NSDate timeIntervalSinceReferenceDate] - diffStart;
+	
+	NSMutableArray *tempResult = [NSMutableArray arrayWithCapacity:array.count];
+	NSMutableIndexSet *inserted = [NSMutableIndexSet new];
+	NSMutableIndexSet *updated = [NSMutableIndexSet new];
+	NSMutableIndexSet *removed = [NSMutableIndexSet indexSetWithIndexesInRange:window];
+	NSMutableArray *survivorsFrom = [NSMutableArray new]; // old index of each matched element, in new order
+	NSMutableArray *survivorsTo = [NSMutableArray new];
+	NSMutableDictionary *merged = [NSMutableDictionary new]; // elements outside the window to replace in place, keyed on index
 	
 	for (id elem in array) {
 		NSObject *instance = elem; // default to the raw array element
 		// there may be some unintentional duplication of logic here and loadProperty
-		if (self.nativeClass && self.classDepth == 1 && [elem isKindOfClass:[NSDictionary class]]) {
-//			NSObject *instance = [[self.arrayClass alloc] init];
-//			[instance.presto loadWithDictionary:elem];
-			instance = [self.manager instantiateClass:self.nativeClass withDictionary:elem];
+		if (self.nativeClass && self.classDepth == 1 && !lazy && [elem isKindOfClass:[NSDictionary class]]) {
+			instance = [self.manager instantiateClass:self.nativeClass withDictionary:elem context:self.loadContext];
 			// if we assume nativeClass only applies once, we should be done with it now
 		}
-			// (experimental) this algorithm is now optimized for stable order arrays, but should still work in all cases
-		BOOL found = NO;
-		NSUInteger count = strongTarget.count;
-		for (int i = lastIndex; i < count && i != (lastIndex - 1) % count; i = (i + 1) % count) {
-			NSObject *existing = strongTarget[i];
-			if ([existing isEqual:instance]) {
-				if (LOG_VERBOSE)
-					PRLog(@"Presto: Found existing object in array (%@). Will load in place.", [existing description]);
-				instance = existing;
-				found = YES;
-				changed = [instance.presto loadWithDictionary:elem] || changed; // make sure it's ok to not call loadwithjsonobject // also this shoudl return BOOL changed
-//					[resultState addObject:existing];
-				[strongTarget removeObjectAtIndex:i]; // we don't technically need to remove the element, but it should make subsequent iterations quicker (unless removing itself is costly, i honestly don't know)
-				lastIndex = i;
-				break;
+		
+		NSUInteger index = window.location + tempResult.count;
+		NSUInteger matchedIndex = NSNotFound;
+		BOOL outside = NO;
+		BOOL isNative = self.nativeClass && [instance isKindOfClass:self.nativeClass];
+		NSMutableArray *indexes = [existingIndexes objectForKey:lazyTarget ? [self identityOfLazyElement:instance] : [PrestoIdentity identityOf:instance]];
+		
+		if (indexes.count) {
+			NSUInteger existingIndex = [indexes[0] unsignedIntegerValue];
+			NSObject *existing = current[existingIndex];
+			[indexes removeObjectAtIndex:0];
+			matchedIndex = existingIndex;
+			outside = !NSLocationInRange(existingIndex, window);
+			if (!outside) {
+				[removed removeIndex:existingIndex];
+				[survivorsFrom addObject:@(existingIndex)];
+				[survivorsTo addObject:@(index)];
 			}
-		}
 			
-		if (!found) {
-			changed = YES;
-//				[resultState addObject:instance];
+			if (LOG_VERBOSE)
+				PRLog(@"Presto: Found existing object in array (%@). Will load in place.", [existing description]);
+			
+			if (existing == instance) {
+				// a registered instance that instantiateClass: already loaded in place, or an identical raw value
+				if (isNative && instance.presto.loadChanged)
+					[updated addIndex:existingIndex];
+			} else if (lazyTarget && [existing isKindOfClass:[NSDictionary class]]) {
+				// never read, so there's no instance to keep; matched by key, the new element replaces it if it differs
+				if ([existing isEqual:elem])
+					instance = existing;
+				else
+					[updated addIndex:existingIndex];
+			} else if ([elem isKindOfClass:[NSDictionary class]] && ![existing isKindOfClass:[NSDictionary class]]) {
+				if ([self loadChild:existing withSubtree:elem])
+					[updated addIndex:existingIndex];
+				instance = existing;
+			} else if (isNative) {
+				// equal but already bound to a different instance, so the old one can't be loaded in place
+				[updated addIndex:existingIndex];
+			} else {
+				instance = existing; // equal raw values
+			}
+		} else {
+			[inserted addIndex:index];
 		}
 		
 		if (self.nativeClass && self.classDepth > 1)
 			[instance.presto withClass:self.nativeClass atDepth:self.classDepth - 1];
 		
 		// TODO: unify this somewhere
-		if (self.manager.trackParentObjects)
+		if (self.manager.trackParentObjects && !(lazyTarget && [instance isKindOfClass:[NSDictionary class]])) // raw elements get theirs when materialized
 			instance.presto.parent = strongTarget;
 		
-		[tempResult addObject:instance];
+		if (outside)
+			merged[@(matchedIndex)] = instance;
+		else
+			[tempResult addObject:instance];
+	}
+	
+	NSAssert(tempResult.count + merged.count <= array.count, @"Array count mismatch!");
+	self.loadedWindowLength = tempResult.count;
+	
+	if (metrics)
+		diffStart = [NSDate timeIntervalSinceReferenceDate];
+	
+	// survivors that stay in relative order haven't moved; the rest did
+	NSIndexSet *stationary = PrestoLongestIncreasingSubsequence(survivorsFrom);
+	NSMutableArray *moves = [NSMutableArray new];
+	for (NSUInteger i = 0; i < survivorsFrom.count; i++) {
+		if (![stationary containsIndex:i])
+			[moves addObject:@[survivorsFrom[i], survivorsTo[i]]];
 	}
 	
-	NSAssert(tempResult.count == array.count, @"Array count mismatch!");
+	PrestoArrayDiff *diff = [PrestoArrayDiff new];
+	diff.insertedIndexes = inserted;
+	diff.removedIndexes = removed;
+	diff.updatedIndexes = updated;
+	diff.moves = moves;
+	
+	if (metrics)
+		metrics.diff += [NSDate timeIntervalSinceReferenceDate] - diffStart;
 	
-	// if there are any elements left in strongTarget, they have since been removed
-	if (strongTarget.count)
-		changed = YES;
+	BOOL changed = diff.hasChanges;
+	
+	if (changed) {
+		NSMutableArray *result = [NSMutableArray arrayWithCapacity:existingCount - window.length + tempResult.count];
+		[result addObjectsFromArray:[current subarrayWithRange:NSMakeRange(0, window.location)]];
+		[result addObjectsFromArray:tempResult];
+		[result addObjectsFromArray:[current subarrayWithRange:NSMakeRange(NSMaxRange(window), existingCount - NSMaxRange(window))]];
+		[merged enumerateKeysAndObjectsUsingBlock:^(NSNumber *existingIndex, id instance, BOOL *stop) {
+			NSUInteger index = existingIndex.unsignedIntegerValue;
+			if (index >= NSMaxRange(window))
+				index = index - window.length + tempResult.count; // past the window, which may have grown or shrunk
+			result[index] = instance;
+		}];
+		[strongTarget setArray:result];
+	}
 	
-	[strongTarget removeAllObjects];
-	[strongTarget addObjectsFromArray:tempResult];
+	if (LOG_VERBOSE)
+		PRLog(@"Presto: Reconciled array for %@: %@", self.source.url.absoluteString, diff);
 	
+	self.lastDiff = diff;
+	self.loadChanged = changed;
 	[self callSuccessBlocks:changed];
 
 	// this is not likely, but supports subclassing of NSArray
@@ -1178,28 +4740,93 @@ static id ValueForUndefinedKey;
 	return changed;
 }
 
-// returns "changed"
-// if this only applies to native classes we can assume nativeClass will already be applied before this point and won't need to be again
-- (BOOL)loadProperty:(NSString *)propertyName withObject:(id)value {
-	BOOL changed = NO;
+// loads an embedded object or array from its part of the response, skipping it entirely if that part is identical to what it was last loaded from
+// the digest is kept per target instead of the sub-payload itself
+- (BOOL)loadSubtree:(id)jsonObject {
+	return [self loadSubtree:jsonObject withDigest:@(PrestoDigestObject(jsonObject))];
+}
+
+// loads an embedded object as part of our own load, so whatever it instantiates is counted and deferred with the rest
+- (BOOL)loadChild:(NSObject *)child withSubtree:(id)jsonObject {
+	PrestoMetadata *metadata = child.presto;
+	PrestoLoadContext *context = metadata.loadContext;
+	metadata.loadContext = self.loadContext;
+	BOOL changed = [metadata loadSubtree:jsonObject];
+	metadata.loadContext = context;
+	return changed;
+}
+
+- (BOOL)loadSubtree:(id)jsonObject withDigest:(NSNumber *)digest {
+	// an identical payload only means nothing changed if the target hasn't been modified locally since it was loaded
+	if ([self.loadedDigest isEqualToNumber:digest] && [self isUnmodifiedSinceLoad]) {
+		if (LOG_VERBOSE)
+			PRLog(@"Presto: Skipping unchanged %@.", [self.target class]);
+		self.loadChanged = NO;
+		if (_completions.count)
+			[self callSuccessBlocks:NO]; // still completes anything waiting on it
+		return NO;
+	}
 	
-	// get the type of the property from the current class
-	// http://stackoverflow.com/a/3497822/238948
-	
-	// i don't think this takes into account inheritance; yeah it does, nevermind
-	objc_property_t propType = nil;
-	Class class = self.targetClass;//[self.target class];
-//	while (propType == nil && class != nil) {
-	propType = class_getProperty(class, [propertyName UTF8String]);
-//		if (propType)
-//			break;
-//		class = [class superclass];
-//	}
-	if (propType == nil) {
-		if (LOG_WARNINGS)
-			[self.manager warnProperty:propertyName forClass:class valueClass:[value class]];
+	BOOL changed = [self loadWithJSONObject:jsonObject];
+	self.loadedDigest = digest; // after the load, which clears it
+	[self recordLoadedValues];
+	return changed;
+}
+
+// the target's contents one level down: the value of each serializable field, or the elements (and keys) of a collection
+- (NSArray *)currentValues {
+	__strong NSObject *strongTarget = self.weakTarget;
+	if (!strongTarget)
+		return nil;
+	
+	if ([strongTarget isKindOfClass:[NSArray class]])
+		return [(NSArray *)strongTarget copy];
+	if ([strongTarget isKindOfClass:[NSDictionary class]])
+		return [[(NSDictionary *)strongTarget allKeys] arrayByAddingObjectsFromArray:[(NSDictionary *)strongTarget allValues]]; // in matching order
+	
+	PrestoClassDescriptor *classDescriptor = [self.manager descriptorForClass:[strongTarget class]];
+	NSMutableArray *values = [NSMutableArray arrayWithCapacity:classDescriptor.serializableProperties.count];
+	for (PrestoPropertyDescriptor *property in classDescriptor.serializableProperties)
+		[values addObject:[property valueForTarget:strongTarget] ?: [NSNull null]];
+	return values;
+}
+
+- (void)recordLoadedValues {
+	NSArray *values = [self currentValues];
+	NSMutableArray *loadedValues = [NSMutableArray arrayWithCapacity:values.count];
+	for (id value in values)
+		[loadedValues addObject:PrestoLoadedValue(value)];
+	self.loadedValues = loadedValues;
+}
+
+// whether the target still holds what it was last loaded with, without serializing it
+// only the fields themselves are compared; anything below them that Presto loaded checks its own fields in turn
+- (BOOL)isUnmodifiedSinceLoad {
+	NSArray *loadedValues = self.loadedValues;
+	NSArray *values = [self currentValues];
+	if (!loadedValues || values.count != loadedValues.count)
 		return NO;
+	
+	for (NSUInteger i = 0; i < values.count; i++) {
+		id value = values[i];
+		id loaded = PrestoLoadedValue(value);
+		if (loaded != loadedValues[i] && ![loaded isEqual:loadedValues[i]])
+			return NO;
+		if (loaded == value && !PrestoIsJSONScalar(value)) {
+			PrestoMetadata *metadata = objc_getAssociatedObject(value, @selector(presto));
+			if (!metadata.loadedValues || ![metadata isUnmodifiedSinceLoad])
+				return NO; // something we can't see into, or that has been modified
+		}
 	}
+	return YES;
+}
+
+// returns "changed"
+// if this only applies to native classes we can assume nativeClass will already be applied before this point and won't need to be again
+- (BOOL)loadProperty:(PrestoPropertyDescriptor *)property withObject:(id)value {
+	BOOL changed = NO;
+	NSString *propertyName = property.name;
+	Class class = self.targetClass;
 	
 	if ((value == nil || value == [NSNull null]) && self.manager.ignoreNulls) {
 		if (LOG_VERBOSE)
@@ -1207,28 +4834,10 @@ static id ValueForUndefinedKey;
 		return NO;
 	}
 	
-	Class propertyClass, protocolClass;
-	if ([value isKindOfClass:[NSDictionary class]] || [value isKindOfClass:[NSArray class]]) {
-		NSString* typeString = [NSString stringWithUTF8String:property_getAttributes(propType)];
-		NSString* typeAttribute = [typeString componentsSeparatedByString:@","][0];
-		NSString* typeName = [typeAttribute substringWithRange:NSMakeRange(3, [typeAttribute length] - 4)];
-		long protocolIndex = [typeName rangeOfString:@"<"].location; // 0 if typeName is nil
-		if (protocolIndex != 0 && protocolIndex != NSNotFound) {
-			// TODO: improve and unify with toDictionary
-			NSString* protocolName = [typeName substringWithRange:NSMakeRange(protocolIndex + 1, [typeName rangeOfString:@">"].location - protocolIndex - 1)];
-//			if ([protocolName containsString:@","])
-//				NSLog(@"Protocol: %@", protocolName);
-			NSString* protocolTypeName = protocolName;//[self typeNameForProtocolName:protocolName]; // TODO: reimplement
-			protocolClass = NSClassFromString(protocolTypeName);
-			if (protocolClass == nil && LOG_WARNINGS) {
-				PRLog(@"pRESTo Warning: protocolClass not determinable from protocol name ‘%@’.", protocolName);
-			}
-			typeName = [typeName substringToIndex:protocolIndex];
-		}
-		propertyClass = NSClassFromString(typeName);
-	}
+	// the property and element classes are resolved once per class (see PrestoClassDescriptor)
+	Class propertyClass = property.propertyClass, protocolClass = property.protocolClass;
 	
-	id existingValue = [self.target valueForKey:propertyName];
+	id existingValue = [property valueForTarget:self.target];
 	
 	if ([value isKindOfClass:[NSDictionary class]]) {
 		if ([propertyClass isSubclassOfClass:[NSDictionary class]]) {
@@ -1238,7 +4847,7 @@ static id ValueForUndefinedKey;
 			if (protocolClass) {
 				if (existingValue && [existingValue isKindOfClass:[NSObject class]]) {
 					// always favor in-place loading whenever possible
-					changed = [((NSObject *)existingValue).presto loadWithDictionary:value];
+					changed = [self loadChild:existingValue withSubtree:value];
 				} else {
 					changed = YES;
 					NSMutableDictionary* valueDict = [NSMutableDictionary dictionaryWithCapacity:[(NSDictionary*)value count]];
@@ -1250,29 +4859,31 @@ static id ValueForUndefinedKey;
 							[valueDict setObject:elem forKey:key];
 							continue;
 						}
-						NSObject *childObject = [self.manager instantiateClass:protocolClass withDictionary:elem];
+						NSObject *childObject = [self.manager instantiateClass:protocolClass withDictionary:elem context:self.loadContext];
 						
 						if (self.manager.trackParentObjects)
 							childObject.presto.parent = valueDict;
 						
 						[valueDict setObject:childObject forKey:key];
 					}
-					[self setTargetValue:valueDict forKey:propertyName];
+					[self setTargetValue:valueDict forProperty:property];
 				}
 			} else {
-				changed = YES; // TODO: recursively compare dictionaries? isEqualToDictionary: is not enough i don't think
-				[self setTargetValue:value forKey:propertyName];
+				// isEqualToDictionary: is not enough (it treats booleans and numbers alike), so compare digests instead
+				changed = ![existingValue isKindOfClass:[NSDictionary class]] || PrestoDigestObject(existingValue) != PrestoDigestObject(value);
+				if (changed)
+					[self setTargetValue:value forProperty:property];
 			}
 		} else {
 			// assume it is an embedded object
 			if (existingValue && [existingValue isKindOfClass:propertyClass])
-				changed = [((NSObject *)existingValue).presto loadWithDictionary:value];
+				changed = [self loadChild:existingValue withSubtree:value];
 			else {
 				changed = YES; // it's not reliable enough to use isEqual: because that will often just compare identities; we need to know if the *data* (full contents) of the object has changed or not (which we can't currently know unless we were to record sub-payloads or something)
-				id childObject = [self.manager instantiateClass:propertyClass withDictionary:value];
+				id childObject = [self.manager instantiateClass:propertyClass withDictionary:value context:self.loadContext];
 //				if (![existingValue isEqual:childObject]) // this is not reliable enough
 //					changed = YES;
-				[self setTargetValue:childObject forKey:propertyName];
+				[self setTargetValue:childObject forProperty:property];
 			}
 		}
 	} else if ([value isKindOfClass:[NSArray class]] && protocolClass != nil) {
@@ -1290,10 +4901,10 @@ static id ValueForUndefinedKey;
 		
 //		childArray.presto.arrayClass = protocolClass;
 		[childArray.presto withClass:protocolClass atDepth:self.classDepth - 1]; // verify
-		changed = [childArray.presto loadWithArray:value] || changed;
+		changed = [self loadChild:childArray withSubtree:value] || changed;
 		
 		if (new)
-			[self setTargetValue:childArray forKey:propertyName];
+			[self setTargetValue:childArray forProperty:property];
 	} else {
 		// TODO: error handling
 		if (value == [NSNull null])
@@ -1307,7 +4918,7 @@ static id ValueForUndefinedKey;
 			if (![existingValue isEqual:value]) // FIXME: doesn't work for nil
 				changed = YES;
 			@try {
-				[self setTargetValue:value forKey:propertyName];
+				[self setTargetValue:value forProperty:property];
 			}
 			@catch (NSException* exception) {
 				PRLog(@"Exception attempting to set value for key ‘%@’:\n%@", propertyName, exception);
@@ -1318,9 +4929,9 @@ static id ValueForUndefinedKey;
 	return changed;
 }
 
-- (void)setTargetValue:(NSObject *)value forKey:(NSString *)key {
+- (void)setTargetValue:(NSObject *)value forProperty:(PrestoPropertyDescriptor *)property {
 	@try {
-		[self.target setValue:value forKey:key];
+		[property setValue:value forTarget:self.target];
 		
 		// parent object tracking--we only want to track the parent on "real objects"
 		if (self.manager.trackParentObjects && ![value isKindOfClass:[NSNumber class]] && ![value isKindOfClass:[NSString class]])
@@ -1328,7 +4939,7 @@ static id ValueForUndefinedKey;
 	}
 	@catch (NSException *exception) {
 		if (LOG_WARNINGS)
-			PRLog(@"pRESTo Warning: Couldn’t set %@.%@ to %@.", self.targetClass, key, value);
+			PRLog(@"pRESTo Warning: Couldn’t set %@.%@ to %@.", self.targetClass, property.name, value);
 		
 		// TODO: adding proper converters might help a lot to avoid this
 		
@@ -1349,6 +4960,27 @@ static id ValueForUndefinedKey;
 	return self;
 }
 
+- (PrestoMetadata *)withLazyMaterialization {
+	self.materializesLazily = YES;
+	return self;
+}
+
+// lazy elements are kept in a PrestoLazyArray or PrestoLazyDictionary, so this only applies to targets we create ourselves
+- (BOOL)materializesTargetLazily {
+	if (!self.materializesLazily || !self.nativeClass || self.classDepth != 1)
+		return NO;
+	
+	__strong id strongTarget = self.weakTarget;
+	return !strongTarget || [strongTarget isKindOfClass:[PrestoLazyArray class]] || [strongTarget isKindOfClass:[PrestoLazyDictionary class]];
+}
+
+// raw elements are identified by the key their class would give them, so they match their materialized instances across reloads
+- (PrestoIdentity *)identityOfLazyElement:(id)elem {
+	if ([elem isKindOfClass:[NSDictionary class]])
+		return [PrestoIdentity identityOf:elem withKey:[self.manager identifyingKeyForClass:self.nativeClass dictionary:elem]];
+	return [PrestoIdentity identityOf:elem];
+}
+
 - (PrestoMetadata *)withErrorClass:(Class)class atDepth:(int)depth {
 	self.errorClass = class;
 	self.errorDepth = depth;
@@ -1367,7 +4999,69 @@ static id ValueForUndefinedKey;
 }
 
 - (NSString *)toJSONStringWithTemplate:(id)template prettyPrinted:(BOOL)pretty {
-	return [[NSString alloc] initWithData:[NSJSONSerialization dataWithJSONObject:[self toJSONObjectWithTemplate:template] options:pretty ? NSJSONWritingPrettyPrinted : 0 error:nil] encoding:NSUTF8StringEncoding];
+	if (!pretty)
+		return [[NSString alloc] initWithData:[self toJSONDataWithTemplate:template] encoding:NSUTF8StringEncoding];
+	return [[NSString alloc] initWithData:[NSJSONSerialization dataWithJSONObject:[self toJSONObjectWithTemplate:template] options:NSJSONWritingPrettyPrinted error:nil] encoding:NSUTF8StringEncoding];
+}
+
+// serializes the target straight to UTF-8 without building an intermediate dictionary; this is what request bodies are made from
+- (NSData *)toJSONDataWithTemplate:(id)template {
+	__strong id strongTarget = self.weakTarget;
+	if (!strongTarget)
+		return nil;
+	
+	PrestoJSONWriter *writer = self.manager.jsonWriter;
+	@synchronized (writer) {
+		[writer reset];
+		[writer writeObject:strongTarget template:template];
+		return [writer data];
+	}
+}
+
+#pragma mark -
+
+- (void)setTracksChanges:(BOOL)tracksChanges {
+	_tracksChanges = tracksChanges;
+	self.fieldDigests = tracksChanges ? [self currentFieldDigests] : nil; // changes are counted from now
+}
+
+- (PrestoMetadata *)withChangeTracking {
+	self.tracksChanges = YES;
+	return self;
+}
+
+// the digest of each serializable field as it would be sent now
+- (NSDictionary *)currentFieldDigests {
+	__strong NSObject *strongTarget = self.weakTarget;
+	if (!strongTarget || [strongTarget isKindOfClass:[NSDictionary class]] || [strongTarget isKindOfClass:[NSArray class]])
+		return nil; // only custom classes have fields to track
+	
+	PrestoClassDescriptor *classDescriptor = [self.manager descriptorForClass:[strongTarget class]];
+	NSMutableDictionary *digests = [NSMutableDictionary dictionaryWithCapacity:classDescriptor.serializableProperties.count];
+	PrestoJSONWriter *writer = self.manager.jsonWriter;
+	
+	@synchronized (writer) {
+		for (PrestoPropertyDescriptor *property in classDescriptor.serializableProperties) {
+			[writer reset];
+			if ([writer writePropertyValue:[property valueForTarget:strongTarget] ofProperty:property template:nil])
+				digests[property.fieldName] = @(PrestoDigestBytes(PrestoDigestSeed, writer.bytes, writer.length));
+		}
+	}
+	
+	return digests;
+}
+
+- (NSArray *)changedFields {
+	NSDictionary *digests = [self currentFieldDigests];
+	if (!self.fieldDigests)
+		return digests.allKeys; // without a baseline, everything counts as changed
+	
+	NSMutableArray *changedFields = [NSMutableArray new];
+	[digests enumerateKeysAndObjectsUsingBlock:^(NSString *field, NSNumber *digest, BOOL *stop) {
+		if (![self.fieldDigests[field] isEqualToNumber:digest])
+			[changedFields addObject:field];
+	}];
+	return changedFields;
 }
 
 - (id)toJSONObject {
@@ -1403,19 +5097,10 @@ static id ValueForUndefinedKey;
 	if ([self.target isKindOfClass:[NSDictionary class]])
 		return self.target; // we're already a dictionary! this avoids attempting to serialize NSDictionary's properties
 	
-	NSMutableArray* properties = [NSMutableArray new];
-	Class class = [strongTarget class];
-	
-	while (class && class != [NSObject class]) {
-		uint count;
-		objc_property_t* c_properties = class_copyPropertyList(class, &count);
-		for (int i = 0; i < count; i++)
-			[properties addObject:[NSValue valueWithBytes:&c_properties[i] objCType:@encode(objc_property_t)]]; // TODO: do we need to free this ever? documentation isn't clear
-		free(c_properties);
-		class = [class superclass];
-	}
+	// weak, read-only, DoNotSerialize and non-whitelisted properties are already filtered out of serializableProperties
+	PrestoClassDescriptor *classDescriptor = [self.manager descriptorForClass:[strongTarget class]];
 	
-	NSMutableDictionary* dictionary = [NSMutableDictionary dictionaryWithCapacity:properties.count];
+	NSMutableDictionary* dictionary = [NSMutableDictionary dictionaryWithCapacity:classDescriptor.serializableProperties.count];
 	NSArray *serializationKeys;
 	if (template) {
 		if ([template isKindOfClass:[NSDictionary class]])
@@ -1426,64 +5111,19 @@ static id ValueForUndefinedKey;
 //	if ([self.target respondsToSelector:@selector(serializingKeys)])
 //		serializationKeys = [[self.target serializingKeys] mutableCopy];
 	
-	for (NSValue* value in properties) {
-		objc_property_t c_property;
-		[value getValue:&c_property];
-		NSString* propertyName = [NSString stringWithCString:property_getName(c_property) encoding:NSUTF8StringEncoding];
-		if ([propertyName isEqualToString:@"presto"])
-			continue;
-		NSString* fieldName = [self.manager fieldNameForProperty:propertyName forClass:[strongTarget class]];//self.targetClass];
+	for (PrestoPropertyDescriptor *property in classDescriptor.serializableProperties) {
+		NSString* propertyName = property.name;
+		NSString* fieldName = property.fieldName;
 		if (serializationKeys && ![serializationKeys containsObject:fieldName]) {
 			if (LOG_VERBOSE)
 				NSLog(@"Presto: Skipping property “%@” as it's not in serializationKeys.", propertyName);
 			continue;
 		}
 		
-		Class protocolClass;
-		NSString* typeString = [NSString stringWithUTF8String:property_getAttributes(c_property)];
-		// FIXME: this is horrible! ugh!
-		NSString* propertiesString = [typeString substringWithRange:NSMakeRange([typeString rangeOfString:@","].location, [typeString rangeOfString:@"," options:NSBackwardsSearch].location - [typeString rangeOfString:@","].location)];
-		if ([propertiesString containsString:@"W"]) {
-			if (LOG_VERBOSE)
-				NSLog(@"Presto: Skipping weak property “%@” (%@).", propertyName, typeString);
-			continue;
-		}
-		if ([propertiesString containsString:@"R"]) {
-			if (LOG_VERBOSE)
-				NSLog(@"Presto: Skipping read-only property “%@” (%@).", propertyName, typeString);
-			continue;
-		}
-		NSString* typeAttribute = [typeString componentsSeparatedByString:@","][0];
-		NSString* typeName = @"";
-		if (typeAttribute.length >= 4)
-			typeName = [typeAttribute substringWithRange:NSMakeRange(3, [typeAttribute length] - 4)];
-		NSString* propertyType = [typeAttribute substringFromIndex:1];
-		long protocolIndex = [typeName rangeOfString:@"<"].location; // 0 if typeName is nil
-		if (protocolIndex != 0 && protocolIndex != NSNotFound) {
-			NSString* protocolName = [typeName substringWithRange:NSMakeRange(protocolIndex + 1, [typeName rangeOfString:@">" options:NSBackwardsSearch].location - protocolIndex - 1)];
-//			if ([protocolName containsString:@","])
-//				NSLog(@"Protocol: %@", protocolName);
-			NSArray* protocolNames = [protocolName componentsSeparatedByString:@"><"];
-			if ([protocolNames containsObject:@"DoNotSerialize"])
-				continue;
-			NSString* protocolTypeName = protocolName;//[self typeNameForProtocolName:protocolName]; // TODO: reimplement
-			protocolClass = NSClassFromString(protocolTypeName);
-			if (protocolClass == nil && LOG_WARNINGS) {
-				PRLog(@"pRESTo Warning: protocolClass not determinable from protocol name ‘%@’.", protocolName);
-			}
-			typeName = [typeName substringToIndex:protocolIndex];
-		}
-//		propertyClass = NSClassFromString(typeName);
-		
-//		NSLog(@"propertyName: %@ class: %@", propertyName, [self.target class]);//temp
-//		Class testClass = NSClassFromString(NSStringFromClass([self.target class]));
-		if (![self.manager shouldPropertyBeSerialized:propertyName forClass:self.targetClass])
-			continue;
-		
-		BOOL isBool = strcmp([propertyType UTF8String], @encode(BOOL)) == 0;
+		BOOL isBool = property.isBool;
 		
-		id value = [self.target valueForKey:propertyName];
-		if (value == self.target)
+		id value = [property valueForTarget:strongTarget];
+		if (value == strongTarget)
 			NSAssert(false, @"whoa wait a second");
 		
 		id subTemplate = [template isKindOfClass:[NSDictionary class]] ? template[fieldName] : nil;
@@ -1534,7 +5174,6 @@ static id ValueForUndefinedKey;
 
 
 	}
-//	free(properties);
 	
 	// add null values for any missing keys
 	for (NSString* key in serializationKeys) {
@@ -1568,17 +5207,48 @@ static id ValueForUndefinedKey;
 	if (target) {
 		rec.owner = target;
 		rec.hasOwner = YES;
+		[self.manager observeDeallocationOf:target]; // its requests may be all that's left waiting on it
 	}
 	rec.success = dependency;
-	[self.callbacks addObject:rec];
+	[self addDependency:rec];
+	
+	return self;
+}
+
+- (PrestoMetadata *)onChangeWithDiff:(PrestoDiffCallback)dependency {
+	return [self onChangeWithDiff:dependency forLifetimeOf:nil];
+}
+
+- (PrestoMetadata *)onChangeWithDiff:(PrestoDiffCallback)dependency forLifetimeOf:(id)target {
+	PrestoDependencyRecord* rec = [PrestoDependencyRecord new];
+	if (target) {
+		rec.owner = target;
+		rec.hasOwner = YES;
+		[self.manager observeDeallocationOf:target]; // its requests may be all that's left waiting on it
+	}
+	rec.diffSuccess = dependency;
+	[self addDependency:rec];
+	
+	return self;
+}
+
+- (void)addDependency:(PrestoDependencyRecord *)rec {
+	[self.dependencies addObject:rec];
 	
 	// slight hack here: if we add a dependency and there are no sources at all, we should probably still call it (allows for manually controlling an object that may not necessarily be loaded from the server)
 	// should we perhaps wrap the isLoaded check in an async block so as to decouple the check from the definition of the source
 	// typically we always define the source first so perhaps this isn't a big deal, but for completeness we probably should
-	if (self.isLoaded) // used to have && !isLoading, but i removed this to support changed flag
-		dependency(self.target);
-	else if (!self.isLoading) {
-		dispatch_async(dispatch_get_main_queue(), ^{
+	// used to have && !isLoading, but i removed this to support changed flag
+	// if stale, show the cached state while it's revalidated
+	if (self.isLoaded || self.isStale) {
+		if (rec.diffSuccess)
+			rec.diffSuccess(self.target, nil); // nothing to diff against yet
+		else
+			rec.success(self.target);
+	}
+	
+	if (!self.isLoaded && !self.isLoading) {
+		dispatch_async(self.manager.targetQueue, ^{
 			if (!self.isLoading && !self.isDeferred)
 				[self reload];
 			else if (self.isDeferred) {
@@ -1587,8 +5257,6 @@ static id ValueForUndefinedKey;
 			}
 		});
 	}
-	
-	return self;
 }
 
 - (PrestoMetadata *)onComplete:(PrestoCallback)success failure:(PrestoCallback)failure {
@@ -1608,10 +5276,10 @@ static id ValueForUndefinedKey;
 		rec.success = success;
 		rec.failure = failure;
 //		[self.manager.globalCompletions addObject:rec];
-		[self.callbacks addObject:rec];
+		[self.completions addObject:rec];
 		
 		if (!self.isLoading) {
-			dispatch_async(dispatch_get_main_queue(), ^{
+			dispatch_async(self.manager.targetQueue, ^{
 				if (!self.isLoading && !self.isDeferred) // TODO: do we want to defer completions as well? or just dependencies?
 					[self reload];
 				else if (self.isDeferred) {
@@ -1626,66 +5294,46 @@ static id ValueForUndefinedKey;
 
 // TODO: verify that this does not leak memory by keeping arbitrary arrays around indefinitely.
 - (void)addSetCompletion:(PrestoCallback)success failure:(PrestoCallback)failure {
-	NSArray *arrayTarget = (NSArray *)self.target; // should this be __block??
+	NSArray *arrayTarget = (NSArray *)self.target; // the members' completions keep this alive until the group completes
 	
 	// there might be a better way to do this
 	// if this object has its own source/definition, treat it like a normal Presto object
 	// this method is for subscribing to multiple dependencies at once for a completion or group dependency.
-//	if (objc_getAssociatedObject(self, @selector(presto)) && self.presto.source.url) {
-//		[self.presto addCompletion:success];
-//		return;
-//	}
-
-	// this implementation assumes that an object cannot go from a loaded state to a non-loaded state
-//	__block id strongSelf = self; // this used to be weak but it didn't work (array needs to be kept alive until its members complete)
-	// TODO: the above may not be needed now that completions keep strong references
-	__block NSDate* timestamp = [NSDate date];
 	
-//	PRLog(@"Attaching ARRAY completion at timestamp: %f", [timestamp timeIntervalSinceReferenceDate]);
+	if (!arrayTarget.count) {
+		if (success)
+			success(arrayTarget); // nothing to wait for
+		return;
+	}
 	
-	PrestoCallback interceptor = ^(NSObject *_){
-//		__strong typeof(weakSelf) strongSelf = weakSelf;
-		if (!arrayTarget) { // is this even possible anymore?
-//			PRLog(@"Array completion strongSelf has disappeared! Did this array already complete??");
-			return; // the array no longer exists; abort
-		}
-		
-		BOOL allLoaded = YES;
-		
-		for (NSObject *elem in arrayTarget) {
-			if (!elem.presto.isCompleted || [elem.presto loadingSince:timestamp]) {
-				if (LOG_VERBOSE)
-					PRLog(@"Array element %@ %@ failed completion check. array timestamp: %f", elem.presto, elem, [timestamp timeIntervalSinceReferenceDate]);
-				allLoaded = NO;
-				break;
-			}
+	// each member's completion is called exactly once, so we just count them down rather than re-checking every member each time one finishes
+	__block NSUInteger remaining = arrayTarget.count;
+	__block BOOL anyFailed = NO;
+	NSObject *lock = [NSObject new];
+	
+	void (^memberCompleted)(BOOL) = ^(BOOL failed) {
+		BOOL groupCompleted;
+		@synchronized (lock) {
+			anyFailed = anyFailed || failed;
+			groupCompleted = remaining > 0 && --remaining == 0;
 		}
+		if (!groupCompleted)
+			return;
 		
-		if (allLoaded) {
-//			PRLog(@"Array completed. Calling success and setting strongSelf to nil.");
-			BOOL allSucceeded = YES;
-			for (NSObject *elem in arrayTarget) {
-				if (elem.presto.error) {
-					allSucceeded = NO;
-					break;
-				}
-			}
-			if (allSucceeded || !failure) {
-				if (success)
-					success(arrayTarget);
-			} else {
-				if (failure)
-					failure(arrayTarget);
-			}
-//			arrayTarget = nil; // this was above success() does it need to be?
+		if (!anyFailed || !failure) {
+			if (success)
+				success(arrayTarget);
+		} else {
+			failure(arrayTarget);
 		}
 	};
 	
-	for (NSObject *elem in self.target) {
-//		if (![elem isKindOfClass:[RemoteObject class]])
-//			continue; // see above
-		
-		[elem.presto onComplete:interceptor];
+	for (NSObject *elem in arrayTarget) {
+		[elem.presto onComplete:^(NSObject *_) {
+			memberCompleted(NO);
+		} failure:^(NSObject *_) {
+			memberCompleted(YES);
+		}];
 	}
 }
 
@@ -1698,100 +5346,143 @@ static id ValueForUndefinedKey;
 
  // we definitely need a better way to do this
 - (PrestoMetadata *)clearDependencies {
-	for (PrestoCallbackRecord *callback in [self.callbacks copy]) {
-		if ([callback isKindOfClass:[PrestoDependencyRecord class]])
-			[self.callbacks removeObject:callback];
-	}
+	[_dependencies removeAllObjects];
 	return self;
 }
 
-#pragma mark -
-
-- (void)callSuccessBlocks:(BOOL)changed {// includeCompletions:(BOOL)includeCompletions {
-//	if (!self.isLoaded)
-//		return;
+// YES if nothing would receive a response: the target is gone and no callback is still waiting on one
+- (BOOL)isZombie {
+	if (self.target)
+		return NO;
 	
-//	PRLog(@"Calling success blocks for %@\nCallbacks: %d Dependencies: %d", self, self.callbacks.count, self.dependencies.count);
+	if (_completions.count)
+		return NO; // a completion is waiting (and would have kept the target alive, if there was one)
 	
-	// this is weird like this because a callback can result in modifications to the callbacks array; so we need to do it in waves like this
-	// hopefully this won't result in an infinite loop
+	for (PrestoDependencyRecord *dependency in [_dependencies copy]) {
+		if (!dependency.hasOwner || dependency.owner)
+			return NO;
+	}
+	return YES;
+}
+
+// NO if every dependency was tied to an owner that has since disappeared, so there's no one left to refresh for
+- (BOOL)hasLiveDependents {
+	if (_completions.count)
+		return YES; // a completion is waiting
 	
-	// TODO: do we still need to wrap this in a loop? what if we copy the array and clear it before calling any callbacks--will additional callbacks registered within another handler still be called?
+	BOOL ownedOnly = NO;
+	for (PrestoDependencyRecord *dependency in [_dependencies copy]) {
+		if (!dependency.hasOwner || dependency.owner)
+			return YES;
+		ownedOnly = YES;
+	}
+	return !ownedOnly;
+}
+
+#pragma mark -
+
+- (void)callSuccessBlocks:(BOOL)changed {// includeCompletions:(BOOL)includeCompletions {
+//	PRLog(@"Calling success blocks for %@\nCompletions: %d Dependencies: %d", self, (int)_completions.count, (int)_dependencies.count);
 	
 	// TODO: we need to check the timestamp of a callback against the timestamp of the request
 	// we need to figure out these timing issues so that we never have a "stalled" callback
 	// this seems to be especially true for array callbacks
-	__weak __block typeof(self) weakSelf = self;
-	NSArray *callbacks = [self.callbacks copy];
-	
+	__weak typeof(self) weakSelf = self;
 	__block id target = self.target; // verify: does this create a retain cycle?
-	
-	// experimental: it makes sense to me that dependencies be considered higher priority than completions, as completions only execute once, it makes sense that they execute *after* the dependencies, but i'm not sure this makes sense
-	// it may be a better idea to simply call these in whatever order they are registered in, and to not have two separate collections of dependencies vs. completions, but rather a flag to indicate which type each record is
+	NSMutableArray *deliveries = [NSMutableArray new];
 	
 	self.source.error = nil;
 	
-	// note: we may need to account for callbacks added as the result of calling another callback
-	// however, it's possible that we should make this the reseponsibility of the add call. that is, if the object is in the state that it is currently calling callbacks, any new callback added during this time should also be called immediately?
-	
-	for (PrestoCallbackRecord *callback in callbacks) {
-		if ([callback isKindOfClass:[PrestoCompletionRecord class]]) {
-//			if (includeCompletions) {
-				PrestoCompletionRecord *completion = (PrestoCompletionRecord *)callback;
-				// FIXME: make sure this dispatch is enabled for release!
-				if (completion.success) { // it's possible we may have a failure-only callback
-					dispatch_async(dispatch_get_main_queue(), ^{
-	//					__strong typeof(weakSelf) strongSelf = weakSelf;
-	//					completion.success(strongSelf.target);
-							completion.success(target); // is this safe?
-					});
-				}
-				[self.callbacks removeObject:completion];
-//			}
-		} else if (changed && [callback isKindOfClass:[PrestoDependencyRecord class]]) {
-			PrestoDependencyRecord *dependency = (PrestoDependencyRecord *)callback;
+	// dependencies are considered higher priority than completions: completions only execute once, so it makes sense that they execute *after* the dependencies
+	// callbacks registered by another callback land in the collections for the next load, as everything is delivered after we're done here
+	if (changed && _dependencies.count) {
+		PrestoArrayDiff *diff = self.lastDiff; // capture it now; another load may replace it before this runs
+		NSMutableIndexSet *orphaned = [NSMutableIndexSet new];
+		
+		[_dependencies enumerateObjectsUsingBlock:^(PrestoDependencyRecord *dependency, NSUInteger index, BOOL *stop) {
 			__strong id owner = dependency.owner;
-			if (owner || !dependency.hasOwner) {
-				if (dependency.success) { // i don't think this is a concern, but just being careful
-					dispatch_async(dispatch_get_main_queue(), ^{
-						__strong typeof(weakSelf) strongSelf = weakSelf;
-						dependency.success(strongSelf.target);
-					});
-				}
-			} else if (dependency.hasOwner) {
+			if (!owner && dependency.hasOwner) {
 				if (LOG_VERBOSE)
 					PRLog(@"Dependency’s lifetime target has disappeared. Removing dependency.");
-				[self.callbacks removeObject:dependency];
+				[orphaned addIndex:index];
+			} else if (dependency.diffSuccess) {
+				[deliveries addObject:^{
+					__strong typeof(weakSelf) strongSelf = weakSelf;
+					dependency.diffSuccess(strongSelf.target, diff);
+				}];
+			} else if (dependency.success) { // i don't think this is a concern, but just being careful
+				[deliveries addObject:^{
+					__strong typeof(weakSelf) strongSelf = weakSelf;
+					dependency.success(strongSelf.target);
+				}];
+			}
+		}];
+		
+		[_dependencies removeObjectsAtIndexes:orphaned];
+	}
+	
+	if (_completions.count && !self.isStale) { // cached data doesn't complete a load; the revalidation will
+		for (PrestoCompletionRecord *completion in _completions) {
+			PrestoCallback success = completion.success;
+			if (success) { // it's possible we may have a failure-only callback
+				[deliveries addObject:^{
+					success(target); // is this safe?
+				}];
 			}
 		}
+		[_completions removeAllObjects];
 	}
+	
+	[self reportMetricsAfter:deliveries];
+	[self.manager deliverCallbacks:deliveries];
 }
 
 - (void)callFailureBlocks:(BOOL)changed {
-//	PRLog(@"Calling failure blocks for %@\nCallbacks: %d Dependencies: %d", self, self.callbacks.count, self.dependencies.count);
+//	PRLog(@"Calling failure blocks for %@\nCompletions: %d Dependencies: %d", self, (int)_completions.count, (int)_dependencies.count);
 
-	__weak __block typeof(self) weakSelf = self;
-	NSArray *callbacks = [self.callbacks copy];
+	__weak typeof(self) weakSelf = self;
+	NSMutableArray *deliveries = [NSMutableArray new];
 	
-	for (PrestoCallbackRecord *callback in callbacks) {
-		if ([callback isKindOfClass:[PrestoCompletionRecord class]]) {
-			dispatch_async(dispatch_get_main_queue(), ^{
+	for (PrestoDependencyRecord *dependency in _dependencies) {
+		PrestoCallback failure = dependency.failure;
+		if (failure) { // we only call explicit failure blocks on dependencies
+			[deliveries addObject:^{
 				__strong typeof(weakSelf) strongSelf = weakSelf;
-				if (callback.failure)
-					callback.failure(strongSelf.target);
-				else if (callback.success)
-					callback.success(strongSelf.target);
-			});
-			[self.callbacks removeObject:callback];
-		} else if ([callback isKindOfClass:[PrestoDependencyRecord class]]) {
-			if (callback.failure) { // we only call explicit failure blocks on dependencies
-				dispatch_async(dispatch_get_main_queue(), ^{
-					__strong typeof(weakSelf) strongSelf = weakSelf;
-					callback.failure(strongSelf.target);
-				});
-			}
+				failure(strongSelf.target);
+			}];
+		}
+	}
+	
+	for (PrestoCompletionRecord *completion in _completions) {
+		PrestoCallback callback = completion.failure ?: completion.success;
+		if (callback) {
+			[deliveries addObject:^{
+				__strong typeof(weakSelf) strongSelf = weakSelf;
+				callback(strongSelf.target);
+			}];
 		}
 	}
+	[_completions removeAllObjects];
+	
+	[self reportMetricsAfter:deliveries];
+	[self.manager deliverCallbacks:deliveries];
+}
+
+// the report goes last so it can tell how long the callbacks ahead of it took to run
+- (void)reportMetricsAfter:(NSMutableArray *)deliveries {
+	PrestoRequestMetrics *metrics = self.requestMetrics;
+	if (!metrics.isFinished)
+		return; // nothing being collected, or these callbacks didn't come from the response
+	self.requestMetrics = nil;
+	
+	Presto *manager = self.manager;
+	NSTimeInterval triggeredTime = [NSDate timeIntervalSinceReferenceDate];
+	[deliveries addObject:^{
+		metrics.callbackDispatch = [NSDate timeIntervalSinceReferenceDate] - triggeredTime;
+		NSObject<PrestoDelegate> *delegate = manager.delegate;
+		if ([delegate respondsToSelector:@selector(requestDidFinishWithMetrics:)])
+			[delegate requestDidFinishWithMetrics:metrics];
+	}];
 }
 
 #pragma mark -
@@ -0,0 +1,268 @@
+//  The MIT License (MIT)
+//
+//  Copyright © 2018 Logan Murray
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+#import <XCTest/XCTest.h>
+#import "Presto.h"
+#import "PrestoTestSupport.h"
+
+typedef NS_ENUM(NSUInteger, PrestoBenchShape) {
+	PrestoBenchShapeFlat,	// PrestoBenchItem
+	PrestoBenchShapeNested,	// PrestoBenchOrder, with four items each
+	PrestoBenchShapeWide,	// PrestoBenchWideRecord
+};
+
+// the binding hot paths on their own (loadWithArray:, loadWithJSONObject: and toDictionaryWithTemplate:), then the whole pipeline against the stand-in server
+// every payload is generated up front, so only the work under test is measured
+@interface PrestoBindBenchmarks : XCTestCase <PrestoDelegate>
+
+@property (strong, nonatomic) NSMutableArray *reportedMetrics;
+
+@end
+
+@implementation PrestoBindBenchmarks
+
+- (void)setUp {
+	[super setUp];
+	
+	[PrestoStubServer reset];
+	[Presto defaultInstance].sessionConfiguration = [PrestoStubServer sessionConfiguration];
+	self.reportedMetrics = [NSMutableArray new];
+}
+
+- (void)tearDown {
+	[Presto defaultInstance].delegate = nil;
+	[PrestoStubServer reset];
+	
+	[super tearDown];
+}
+
+#pragma mark - loadWithArray:
+
+- (void)testLoadWithArrayFlat100 {
+	[self measureLoadWithArray:PrestoBenchShapeFlat count:100];
+}
+
+- (void)testLoadWithArrayFlat1000 {
+	[self measureLoadWithArray:PrestoBenchShapeFlat count:1000];
+}
+
+- (void)testLoadWithArrayFlat10000 {
+	[self measureLoadWithArray:PrestoBenchShapeFlat count:10000];
+}
+
+- (void)testLoadWithArrayNested100 {
+	[self measureLoadWithArray:PrestoBenchShapeNested count:100];
+}
+
+- (void)testLoadWithArrayNested1000 {
+	[self measureLoadWithArray:PrestoBenchShapeNested count:1000];
+}
+
+- (void)testLoadWithArrayWide100 {
+	[self measureLoadWithArray:PrestoBenchShapeWide count:100];
+}
+
+- (void)testLoadWithArrayWide1000 {
+	[self measureLoadWithArray:PrestoBenchShapeWide count:1000];
+}
+
+// reconciling against what is already bound: an identical payload, then one with every tenth record edited
+- (void)testReloadWithArrayUnchangedFlat1000 {
+	[self measureReloadWithArray:PrestoBenchShapeFlat count:1000 editing:0];
+}
+
+- (void)testReloadWithArrayEditedFlat1000 {
+	[self measureReloadWithArray:PrestoBenchShapeFlat count:1000 editing:10];
+}
+
+- (void)testReloadWithArrayEditedNested1000 {
+	[self measureReloadWithArray:PrestoBenchShapeNested count:1000 editing:10];
+}
+
+#pragma mark - loadWithJSONObject:
+
+- (void)testLoadWithJSONObjectFlat1000 {
+	[self measureLoadWithJSONObject:PrestoBenchShapeFlat count:1000];
+}
+
+- (void)testLoadWithJSONObjectNested1000 {
+	[self measureLoadWithJSONObject:PrestoBenchShapeNested count:1000];
+}
+
+- (void)testLoadWithJSONObjectWide1000 {
+	[self measureLoadWithJSONObject:PrestoBenchShapeWide count:1000];
+}
+
+#pragma mark - toDictionaryWithTemplate:
+
+- (void)testToDictionaryFlat1000 {
+	[self measureToDictionary:PrestoBenchShapeFlat count:1000 template:nil];
+}
+
+- (void)testToDictionaryNested1000 {
+	[self measureToDictionary:PrestoBenchShapeNested count:1000 template:nil];
+}
+
+- (void)testToDictionaryWide1000 {
+	[self measureToDictionary:PrestoBenchShapeWide count:1000 template:nil];
+}
+
+- (void)testToDictionaryWithTemplateWide1000 {
+	[self measureToDictionary:PrestoBenchShapeWide count:1000 template:@[@"recordID", @"text0", @"value0"]];
+}
+
+#pragma mark - Against the server
+
+- (void)testEndToEndFlat1000 {
+	[self measureEndToEnd:PrestoBenchShapeFlat count:1000];
+}
+
+- (void)testEndToEndFlat10000 {
+	[self measureEndToEnd:PrestoBenchShapeFlat count:10000];
+}
+
+- (void)testEndToEndNested1000 {
+	[self measureEndToEnd:PrestoBenchShapeNested count:1000];
+}
+
+- (void)testEndToEndWide1000 {
+	[self measureEndToEnd:PrestoBenchShapeWide count:1000];
+}
+
+#pragma mark -
+
+- (NSMutableArray *)records:(PrestoBenchShape)shape count:(NSUInteger)count {
+	switch (shape) {
+		case PrestoBenchShapeFlat: return [PrestoSyntheticPayload items:count];
+		case PrestoBenchShapeNested: return [PrestoSyntheticPayload orders:count];
+		case PrestoBenchShapeWide: return [PrestoSyntheticPayload wideRecords:count];
+	}
+}
+
+- (Class)classOf:(PrestoBenchShape)shape {
+	switch (shape) {
+		case PrestoBenchShapeFlat: return [PrestoBenchItem class];
+		case PrestoBenchShapeNested: return [PrestoBenchOrder class];
+		case PrestoBenchShapeWide: return [PrestoBenchWideRecord class];
+	}
+}
+
+// loads consume their payloads in place, so each iteration gets its own copy
+- (NSArray *)copies:(NSUInteger)copies ofRecords:(PrestoBenchShape)shape count:(NSUInteger)count {
+	NSMutableArray *payloads = [NSMutableArray arrayWithCapacity:copies];
+	for (NSUInteger i = 0; i < copies; i++)
+		[payloads addObject:[self records:shape count:count]];
+	return payloads;
+}
+
+- (NSMutableArray *)boundRecords:(PrestoBenchShape)shape count:(NSUInteger)count {
+	NSMutableArray *target = [NSMutableArray new];
+	[[target.presto withClass:[self classOf:shape] atDepth:1] loadWithArray:[self records:shape count:count]];
+	return target;
+}
+
+- (void)measureLoadWithArray:(PrestoBenchShape)shape count:(NSUInteger)count {
+	NSArray *payloads = [self copies:10 ofRecords:shape count:count]; // measureBlock: runs ten times
+	__block NSUInteger iteration = 0;
+	
+	[self measureBlock:^{
+		NSMutableArray *target = [NSMutableArray new];
+		[[target.presto withClass:[self classOf:shape] atDepth:1] loadWithArray:payloads[iteration++ % payloads.count]];
+		XCTAssertEqual(target.count, count);
+	}];
+}
+
+- (void)measureReloadWithArray:(PrestoBenchShape)shape count:(NSUInteger)count editing:(NSUInteger)stride {
+	NSMutableArray *target = [self boundRecords:shape count:count];
+	NSArray *payloads = [self copies:10 ofRecords:shape count:count];
+	if (stride) {
+		for (NSMutableArray *payload in payloads) {
+			for (NSUInteger i = 0; i < payload.count; i += stride)
+				payload[i][shape == PrestoBenchShapeNested ? @"status" : @"name"] = [NSUUID UUID].UUIDString;
+		}
+	}
+	__block NSUInteger iteration = 0;
+	
+	[self measureBlock:^{
+		[target.presto loadWithArray:payloads[iteration++ % payloads.count]];
+		XCTAssertEqual(target.count, count);
+	}];
+}
+
+- (void)measureLoadWithJSONObject:(PrestoBenchShape)shape count:(NSUInteger)count {
+	NSArray *payloads = [self copies:10 ofRecords:shape count:count];
+	Class class = [self classOf:shape];
+	__block NSUInteger iteration = 0;
+	
+	[self measureBlock:^{
+		for (NSMutableDictionary *record in payloads[iteration++ % payloads.count]) {
+			NSObject *instance = [class new];
+			[instance.presto loadWithJSONObject:record];
+		}
+	}];
+}
+
+- (void)measureToDictionary:(PrestoBenchShape)shape count:(NSUInteger)count template:(id)template {
+	NSArray *target = [self boundRecords:shape count:count];
+	
+	[self measureBlock:^{
+		for (NSObject *record in target)
+			XCTAssertNotNil([record.presto toDictionaryWithTemplate:template]);
+	}];
+}
+
+// without latency, so this is the cost of the pipeline itself; the stage breakdown is logged from the metrics
+- (void)measureEndToEnd:(PrestoBenchShape)shape count:(NSUInteger)count {
+	[PrestoStubServer respondTo:@"records" withBody:[PrestoSyntheticPayload JSONDataWithObject:[self records:shape count:count]] contentType:@"application/json"];
+	NSURL *url = [PrestoStubServer URLForPath:@"records"];
+	[Presto defaultInstance].delegate = self;
+	
+	[self measureBlock:^{
+		NSMutableArray *target = [NSMutableArray new];
+		XCTestExpectation *completed = [self expectationWithDescription:@"completed"];
+		[[[target.presto getFromURL:url] withClass:[self classOf:shape] atDepth:1] onComplete:^(NSObject *result) {
+			[completed fulfill];
+		}];
+		[self waitForExpectations:@[completed] timeout:30];
+		[target.presto clearDependencies];
+		XCTAssertEqual(target.count, count);
+	}];
+	
+	// metrics are reported after the callbacks, so the last one may still be on its way
+	XCTestExpectation *reported = [self expectationWithDescription:@"reported"];
+	dispatch_async([Presto defaultInstance].targetQueue, ^{
+		[reported fulfill];
+	});
+	[self waitForExpectations:@[reported] timeout:5];
+	
+	for (PrestoRequestMetrics *metrics in self.reportedMetrics) {
+		NSLog(@"%lu bytes, %lu objects: queue %.1f ms, network %.1f ms, parse %.1f ms, transform %.1f ms, bind %.1f ms, diff %.1f ms, callbacks %.1f ms",
+			(unsigned long)metrics.responseBytes, (unsigned long)metrics.objectsInstantiated, metrics.queueWait * 1000, metrics.network * 1000,
+			metrics.parse * 1000, metrics.transform * 1000, metrics.bind * 1000, metrics.diff * 1000, metrics.callbackDispatch * 1000);
+	}
+}
+
+- (void)requestDidFinishWithMetrics:(PrestoRequestMetrics *)metrics {
+	[self.reportedMetrics addObject:metrics];
+}
+
+@end
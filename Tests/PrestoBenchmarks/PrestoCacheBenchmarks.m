@@ -0,0 +1,121 @@
+//  The MIT License (MIT)
+//
+//  Copyright © 2018 Logan Murray
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+#import <XCTest/XCTest.h>
+#import "Presto.h"
+#import "PrestoTestSupport.h"
+
+static const NSTimeInterval PrestoBenchRoundTrip = 0.05; // a good mobile connection
+
+// time from asking for a source until its target is first populated, with and without the response cache
+// the warm runs still revalidate (and get a 304), but that happens after the target has been populated
+@interface PrestoCacheBenchmarks : XCTestCase
+
+@property (strong, nonatomic) PrestoResponseCache *cache;
+
+@end
+
+@implementation PrestoCacheBenchmarks
+
+- (void)setUp {
+	[super setUp];
+	
+	[PrestoStubServer reset];
+	[PrestoStubServer setLatency:PrestoBenchRoundTrip];
+	[Presto defaultInstance].sessionConfiguration = [PrestoStubServer sessionConfiguration];
+	
+	NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+	self.cache = [[PrestoResponseCache alloc] initWithPath:path capacity:64 * 1024 * 1024];
+}
+
+- (void)tearDown {
+	[Presto defaultInstance].responseCache = nil;
+	[self.cache removeAllEntries];
+	[[NSFileManager defaultManager] removeItemAtPath:self.cache.path error:nil];
+	[PrestoStubServer reset];
+	
+	[super tearDown];
+}
+
+- (void)testTimeToFirstObjectCold100 {
+	[self measureTimeToFirstObjectOf:100 cached:NO];
+}
+
+- (void)testTimeToFirstObjectWarm100 {
+	[self measureTimeToFirstObjectOf:100 cached:YES];
+}
+
+- (void)testTimeToFirstObjectCold5000 {
+	[self measureTimeToFirstObjectOf:5000 cached:NO];
+}
+
+- (void)testTimeToFirstObjectWarm5000 {
+	[self measureTimeToFirstObjectOf:5000 cached:YES];
+}
+
+#pragma mark -
+
+- (void)measureTimeToFirstObjectOf:(NSUInteger)count cached:(BOOL)cached {
+	NSString *path = [NSString stringWithFormat:@"items-%lu", (unsigned long)count];
+	NSURL *url = [PrestoStubServer URLForPath:path];
+	[PrestoStubServer respondTo:path withStatus:200 headers:@{@"Content-Type": @"application/json", @"ETag": @"\"v1\""} body:[PrestoSyntheticPayload itemsJSONData:count]];
+	
+	[Presto defaultInstance].responseCache = cached ? self.cache : nil;
+	if (cached)
+		[self loadItemsFrom:url measuring:NO]; // warm it up
+	
+	[self measureMetrics:@[XCTPerformanceMetric_WallClockTime] automaticallyStartMeasuring:NO forBlock:^{
+		NSArray *items = [self loadItemsFrom:url measuring:YES];
+		XCTAssertEqual(items.count, count);
+		XCTAssertTrue([items.firstObject isKindOfClass:[PrestoBenchItem class]]);
+	}];
+}
+
+// returns once the load has completed, so nothing is left in flight for the next iteration
+- (NSArray *)loadItemsFrom:(NSURL *)url measuring:(BOOL)measuring {
+	NSMutableArray *items = [NSMutableArray new];
+	XCTestExpectation *populated = [self expectationWithDescription:@"populated"];
+	XCTestExpectation *completed = [self expectationWithDescription:@"completed"];
+	__block BOOL isPopulated = NO;
+	
+	if (measuring)
+		[self startMeasuring];
+	
+	[[[items.presto getFromURL:url] withClass:[PrestoBenchItem class] atDepth:1] onChange:^(NSObject *result) {
+		if (isPopulated || !items.count)
+			return;
+		isPopulated = YES;
+		if (measuring)
+			[self stopMeasuring];
+		[populated fulfill];
+	}];
+	[items.presto onComplete:^(NSObject *result) {
+		[completed fulfill];
+	}];
+	
+	[self waitForExpectations:@[populated, completed] timeout:30];
+	[items.presto clearDependencies];
+	
+	return items;
+}
+
+@end
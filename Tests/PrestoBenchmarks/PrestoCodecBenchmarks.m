@@ -0,0 +1,118 @@
+//  The MIT License (MIT)
+//
+//  Copyright © 2018 Logan Murray
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+#import <XCTest/XCTest.h>
+#import <compression.h>
+#import "Presto.h"
+#import "PrestoTestSupport.h"
+
+static const NSUInteger PrestoCodecBenchCount = 5000;
+
+// bytes on the wire and time to decode for each codec, on the same records
+// the wire sizes are logged rather than measured, as they don't vary between runs
+@interface PrestoCodecBenchmarks : XCTestCase
+
+@end
+
+@implementation PrestoCodecBenchmarks
+
+- (void)testPayloadSizes {
+	NSArray *items = [PrestoSyntheticPayload items:PrestoCodecBenchCount];
+	NSData *json = [[PrestoJSONCodec new] dataWithObject:items];
+	NSData *msgpack = [[PrestoMessagePackCodec new] dataWithObject:items];
+	
+	NSLog(@"%lu records: JSON %lu bytes (%lu deflated), MessagePack %lu bytes (%lu deflated)", (unsigned long)items.count,
+		(unsigned long)json.length, (unsigned long)[self deflatedLength:json], (unsigned long)msgpack.length, (unsigned long)[self deflatedLength:msgpack]);
+	XCTAssertLessThan(msgpack.length, json.length);
+}
+
+- (void)testJSONDecode {
+	[self measureDecodeWithCodec:[PrestoJSONCodec new]];
+}
+
+- (void)testMessagePackDecode {
+	[self measureDecodeWithCodec:[PrestoMessagePackCodec new]];
+}
+
+- (void)testJSONEncode {
+	[self measureEncodeWithCodec:[PrestoJSONCodec new]];
+}
+
+- (void)testMessagePackEncode {
+	[self measureEncodeWithCodec:[PrestoMessagePackCodec new]];
+}
+
+// the whole pipeline, from request to bound objects, with each codec on the wire
+- (void)testJSONEndToEnd {
+	[self measureLoadWithCodec:[PrestoJSONCodec new]];
+}
+
+- (void)testMessagePackEndToEnd {
+	[self measureLoadWithCodec:[PrestoMessagePackCodec new]];
+}
+
+#pragma mark -
+
+- (void)measureDecodeWithCodec:(id<PrestoCodec>)codec {
+	NSData *data = [codec dataWithObject:[PrestoSyntheticPayload items:PrestoCodecBenchCount]];
+	
+	[self measureBlock:^{
+		NSArray *decoded = [codec objectWithData:data];
+		XCTAssertEqual(decoded.count, PrestoCodecBenchCount);
+	}];
+}
+
+- (void)measureEncodeWithCodec:(id<PrestoCodec>)codec {
+	NSArray *items = [PrestoSyntheticPayload items:PrestoCodecBenchCount];
+	
+	[self measureBlock:^{
+		XCTAssertGreaterThan([codec dataWithObject:items].length, 0);
+	}];
+}
+
+- (void)measureLoadWithCodec:(id<PrestoCodec>)codec {
+	[PrestoStubServer reset];
+	[Presto defaultInstance].sessionConfiguration = [PrestoStubServer sessionConfiguration];
+	[PrestoStubServer respondTo:@"items" withBody:[codec dataWithObject:[PrestoSyntheticPayload items:PrestoCodecBenchCount]] contentType:codec.contentType];
+	NSURL *url = [PrestoStubServer URLForPath:@"items"];
+	
+	[self measureBlock:^{
+		NSMutableArray *items = [NSMutableArray new];
+		XCTestExpectation *completed = [self expectationWithDescription:@"completed"];
+		[[[[items.presto getFromURL:url] withCodec:codec] withClass:[PrestoBenchItem class] atDepth:1] onComplete:^(NSObject *result) {
+			[completed fulfill];
+		}];
+		[self waitForExpectations:@[completed] timeout:30];
+		[items.presto clearDependencies];
+		XCTAssertEqual(items.count, PrestoCodecBenchCount);
+	}];
+	
+	[PrestoStubServer reset];
+}
+
+// roughly what gzip would send, without the 18 bytes of framing
+- (NSUInteger)deflatedLength:(NSData *)data {
+	NSMutableData *buffer = [NSMutableData dataWithLength:data.length + 64];
+	return compression_encode_buffer(buffer.mutableBytes, buffer.length, data.bytes, data.length, NULL, COMPRESSION_ZLIB);
+}
+
+@end
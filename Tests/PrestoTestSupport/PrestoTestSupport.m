@@ -0,0 +1,281 @@
+//  The MIT License (MIT)
+//
+//  Copyright © 2018 Logan Murray
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+#import "PrestoTestSupport.h"
+
+static NSString *const PrestoStubHost = @"presto.stub";
+
+static NSMutableDictionary *PrestoStubResponses; // PrestoStubResponses keyed on URL path; also guards the settings below
+static NSMutableArray *PrestoStubRequests;
+static NSTimeInterval PrestoStubLatency;
+static NSUInteger PrestoStubChunkSize;
+
+#pragma mark - PrestoStubServer
+
+@interface PrestoStubResponse : NSObject
+
+@property (nonatomic) NSInteger statusCode;
+@property (strong, nonatomic) NSDictionary *headers;
+@property (strong, nonatomic) NSData *body;
+
+@end
+
+@implementation PrestoStubResponse
+
+@end
+
+@interface PrestoStubServer ()
+
+@property (strong, nonatomic) NSHTTPURLResponse *response;
+@property (strong, nonatomic) NSData *body;
+@property (nonatomic) NSUInteger chunkSize;
+@property (nonatomic) BOOL isStopped;
+
+@end
+
+@implementation PrestoStubServer
+
++ (void)initialize {
+	if (self == [PrestoStubServer class]) {
+		PrestoStubResponses = [NSMutableDictionary new];
+		PrestoStubRequests = [NSMutableArray new];
+	}
+}
+
++ (NSURLSessionConfiguration *)sessionConfiguration {
+	NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+	configuration.protocolClasses = @[self];
+	return configuration;
+}
+
++ (NSURL *)URLForPath:(NSString *)path {
+	return [NSURL URLWithString:[NSString stringWithFormat:@"http://%@/%@", PrestoStubHost, path]];
+}
+
++ (void)respondTo:(NSString *)path withBody:(NSData *)body contentType:(NSString *)contentType {
+	[self respondTo:path withStatus:200 headers:contentType ? @{@"Content-Type": contentType} : @{} body:body];
+}
+
++ (void)respondTo:(NSString *)path withStatus:(NSInteger)statusCode headers:(NSDictionary *)headers body:(NSData *)body {
+	PrestoStubResponse *response = [PrestoStubResponse new];
+	response.statusCode = statusCode;
+	response.headers = headers;
+	response.body = body ?: [NSData data];
+	
+	@synchronized (PrestoStubResponses) {
+		PrestoStubResponses[[self URLForPath:path].path] = response;
+	}
+}
+
++ (void)setLatency:(NSTimeInterval)latency {
+	@synchronized (PrestoStubResponses) {
+		PrestoStubLatency = latency;
+	}
+}
+
++ (void)setChunkSize:(NSUInteger)chunkSize {
+	@synchronized (PrestoStubResponses) {
+		PrestoStubChunkSize = chunkSize;
+	}
+}
+
++ (NSArray *)receivedRequests {
+	@synchronized (PrestoStubRequests) {
+		return [PrestoStubRequests copy];
+	}
+}
+
++ (void)reset {
+	@synchronized (PrestoStubResponses) {
+		[PrestoStubResponses removeAllObjects];
+		PrestoStubLatency = 0;
+		PrestoStubChunkSize = 0;
+	}
+	@synchronized (PrestoStubRequests) {
+		[PrestoStubRequests removeAllObjects];
+	}
+}
+
+// by the time a protocol sees a session's request, its body has been moved into a stream
++ (NSData *)bodyOfRequest:(NSURLRequest *)request {
+	if (request.HTTPBody || !request.HTTPBodyStream)
+		return request.HTTPBody;
+	
+	NSMutableData *body = [NSMutableData new];
+	NSInputStream *stream = request.HTTPBodyStream;
+	uint8_t buffer[4096];
+	NSInteger length;
+	
+	[stream open];
+	while ((length = [stream read:buffer maxLength:sizeof(buffer)]) > 0)
+		[body appendBytes:buffer length:length];
+	[stream close];
+	
+	return body;
+}
+
+#pragma mark -
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request {
+	return [request.URL.host isEqualToString:PrestoStubHost];
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request {
+	return request;
+}
+
+- (void)startLoading {
+	NSMutableURLRequest *request = [self.request mutableCopy];
+	request.HTTPBody = [PrestoStubServer bodyOfRequest:self.request];
+	@synchronized (PrestoStubRequests) {
+		[PrestoStubRequests addObject:request];
+	}
+	
+	PrestoStubResponse *stub;
+	NSTimeInterval latency;
+	@synchronized (PrestoStubResponses) {
+		stub = PrestoStubResponses[request.URL.path];
+		latency = PrestoStubLatency;
+		self.chunkSize = PrestoStubChunkSize;
+	}
+	
+	NSInteger statusCode = stub ? stub.statusCode : 404;
+	self.body = stub ? stub.body : [NSData data];
+	
+	NSString *entityTag = stub.headers[@"ETag"];
+	if (entityTag && [[request valueForHTTPHeaderField:@"If-None-Match"] isEqualToString:entityTag]) {
+		statusCode = 304;
+		self.body = [NSData data];
+	}
+	
+	self.response = [[NSHTTPURLResponse alloc] initWithURL:request.URL statusCode:statusCode HTTPVersion:@"HTTP/1.1" headerFields:stub.headers];
+	
+	if (latency <= 0) {
+		[self respond];
+		return;
+	}
+	
+	// the client has to be called back on the thread (and in the run loop mode) loading was started on
+	NSThread *thread = [NSThread currentThread];
+	NSArray *modes = @[[NSRunLoop currentRunLoop].currentMode ?: NSDefaultRunLoopMode];
+	dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(latency * NSEC_PER_SEC)), dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
+		[self performSelector:@selector(respond) onThread:thread withObject:nil waitUntilDone:NO modes:modes];
+	});
+}
+
+- (void)stopLoading {
+	self.isStopped = YES;
+}
+
+- (void)respond {
+	if (self.isStopped)
+		return;
+	
+	[self.client URLProtocol:self didReceiveResponse:self.response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+	
+	NSUInteger length = self.body.length;
+	NSUInteger chunkSize = self.chunkSize ?: MAX(length, 1);
+	for (NSUInteger offset = 0; offset < length; offset += chunkSize)
+		[self.client URLProtocol:self didLoadData:[self.body subdataWithRange:NSMakeRange(offset, MIN(chunkSize, length - offset))]];
+	
+	[self.client URLProtocolDidFinishLoading:self];
+}
+
+@end
+
+#pragma mark - Models
+
+@implementation PrestoBenchItem
+
+@end
+
+@implementation PrestoBenchOrder
+
+@end
+
+@implementation PrestoBenchWideRecord
+
+@end
+
+#pragma mark - PrestoSyntheticPayload
+
+@implementation PrestoSyntheticPayload
+
++ (NSMutableDictionary *)item:(NSUInteger)i {
+	return [@{
+		@"itemID": @(i),
+		@"name": [NSString stringWithFormat:@"Item %lu", (unsigned long)i],
+		@"summary": [NSString stringWithFormat:@"Synthetic record %lu, long enough to look like a real description and not just a label.", (unsigned long)i],
+		@"price": @(i * 1.25),
+		@"inStock": @(i % 3 != 0),
+		@"tags": [@[[NSString stringWithFormat:@"tag%lu", (unsigned long)(i % 7)], [NSString stringWithFormat:@"tag%lu", (unsigned long)(i % 11)]] mutableCopy],
+	} mutableCopy];
+}
+
++ (NSMutableArray *)items:(NSUInteger)count {
+	NSMutableArray *items = [NSMutableArray arrayWithCapacity:count];
+	for (NSUInteger i = 0; i < count; i++)
+		[items addObject:[self item:i]];
+	return items;
+}
+
++ (NSMutableArray *)orders:(NSUInteger)count {
+	NSMutableArray *orders = [NSMutableArray arrayWithCapacity:count];
+	for (NSUInteger i = 0; i < count; i++) {
+		NSMutableArray *lines = [NSMutableArray arrayWithCapacity:3];
+		for (NSUInteger j = 1; j <= 3; j++)
+			[lines addObject:[self item:i * 4 + j]];
+		
+		[orders addObject:[@{
+			@"orderID": @(i),
+			@"status": i % 5 ? @"shipped" : @"pending",
+			@"total": @(i * 3.75),
+			@"featured": [self item:i * 4],
+			@"lines": lines,
+		} mutableCopy]];
+	}
+	return orders;
+}
+
++ (NSMutableArray *)wideRecords:(NSUInteger)count {
+	NSMutableArray *records = [NSMutableArray arrayWithCapacity:count];
+	for (NSUInteger i = 0; i < count; i++) {
+		NSMutableDictionary *record = [NSMutableDictionary dictionaryWithCapacity:33];
+		record[@"recordID"] = @(i);
+		for (NSUInteger field = 0; field < 16; field++) {
+			record[[NSString stringWithFormat:@"text%lu", (unsigned long)field]] = [NSString stringWithFormat:@"Field %lu of record %lu", (unsigned long)field, (unsigned long)i];
+			record[[NSString stringWithFormat:@"value%lu", (unsigned long)field]] = @(i * 16 + field);
+		}
+		[records addObject:record];
+	}
+	return records;
+}
+
++ (NSData *)itemsJSONData:(NSUInteger)count {
+	return [self JSONDataWithObject:[self items:count]];
+}
+
++ (NSData *)JSONDataWithObject:(id)object {
+	return [NSJSONSerialization dataWithJSONObject:object options:0 error:nil];
+}
+
+@end
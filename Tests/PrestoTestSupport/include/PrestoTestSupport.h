@@ -0,0 +1,87 @@
+//  The MIT License (MIT)
+//
+//  Copyright © 2018 Logan Murray
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+#import <Foundation/Foundation.h>
+
+/**
+	Stands in for the server in tests and benchmarks. Requests sent through a session built from `sessionConfiguration` are answered from canned responses registered by path, so they go through NSURLSession (and Presto's whole pipeline) without touching the network.
+
+	A response with an `ETag` header is answered with a 304 when the request's `If-None-Match` matches it. Paths with nothing registered get a 404.
+*/
+@interface PrestoStubServer : NSURLProtocol
+
++ (NSURLSessionConfiguration *)sessionConfiguration; // assign to Presto.sessionConfiguration
++ (NSURL *)URLForPath:(NSString *)path;
+
++ (void)respondTo:(NSString *)path withBody:(NSData *)body contentType:(NSString *)contentType;
++ (void)respondTo:(NSString *)path withStatus:(NSInteger)statusCode headers:(NSDictionary *)headers body:(NSData *)body;
+
++ (void)setLatency:(NSTimeInterval)latency;		// before each response starts; default 0
++ (void)setChunkSize:(NSUInteger)chunkSize;		// bodies are delivered in pieces of this many bytes; default 0 delivers them whole
+
++ (NSArray *)receivedRequests;					// NSURLRequests in the order they arrived, with their bodies read back into HTTPBody
++ (void)reset;										// forgets every response and request and restores the defaults
+
+@end
+
+// plain model classes whose properties match the fields of the synthetic records
+@protocol PrestoBenchItem; // names the element class of arrays of them
+
+@interface PrestoBenchItem : NSObject
+
+@property (strong, nonatomic) NSNumber *itemID;
+@property (strong, nonatomic) NSString *name;
+@property (strong, nonatomic) NSString *summary;
+@property (strong, nonatomic) NSNumber *price;
+@property (strong, nonatomic) NSNumber *inStock;
+@property (strong, nonatomic) NSMutableArray *tags;
+
+@end
+
+@interface PrestoBenchOrder : NSObject
+
+@property (strong, nonatomic) NSNumber *orderID;
+@property (strong, nonatomic) NSString *status;
+@property (strong, nonatomic) NSNumber *total;
+@property (strong, nonatomic) PrestoBenchItem *featured;					// an embedded object
+@property (strong, nonatomic) NSMutableArray<PrestoBenchItem> *lines;	// and an array of them
+
+@end
+
+@interface PrestoBenchWideRecord : NSObject
+
+@property (strong, nonatomic) NSNumber *recordID;
+@property (strong, nonatomic) NSString *text0, *text1, *text2, *text3, *text4, *text5, *text6, *text7, *text8, *text9, *text10, *text11, *text12, *text13, *text14, *text15;
+@property (strong, nonatomic) NSNumber *value0, *value1, *value2, *value3, *value4, *value5, *value6, *value7, *value8, *value9, *value10, *value11, *value12, *value13, *value14, *value15;
+
+@end
+
+// deterministic payloads, so runs can be compared with each other
+@interface PrestoSyntheticPayload : NSObject
+
++ (NSMutableArray *)items:(NSUInteger)count;		// flat records with a handful of scalar fields and a short array each (PrestoBenchItem)
++ (NSMutableArray *)orders:(NSUInteger)count;		// records with an embedded item and an array of three more (PrestoBenchOrder)
++ (NSMutableArray *)wideRecords:(NSUInteger)count;	// records with 33 scalar fields (PrestoBenchWideRecord)
++ (NSData *)itemsJSONData:(NSUInteger)count;
++ (NSData *)JSONDataWithObject:(id)object;
+
+@end
@@ -0,0 +1,307 @@
+//  The MIT License (MIT)
+//
+//  Copyright © 2018 Logan Murray
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+#import <XCTest/XCTest.h>
+#import "Presto.h"
+#import "PrestoTestSupport.h"
+
+// not public, but it's what pages and windowed reloads go through
+@interface PrestoMetadata (PrestoArrayDiffTests)
+
+- (BOOL)loadWithArray:(NSArray *)array inWindow:(NSRange)window;
+- (PrestoArrayDiff *)lastDiff;
+
+@end
+
+// identified by recordID, so reloads find the same instances and load them in place
+@interface PrestoDiffRecord : NSObject <PrestoDelegate>
+
+@property (strong, nonatomic) NSNumber *recordID;
+@property (strong, nonatomic) NSString *name;
+
+@end
+
+@implementation PrestoDiffRecord
+
++ (NSString *)identifyingField {
+	return @"recordID";
+}
+
+- (id<NSCopying>)identifyingKey {
+	return self.recordID;
+}
+
+@end
+
+// how array loads are reconciled: the index sets they report, windows and pages, and completions over groups of objects
+@interface PrestoArrayDiffTests : XCTestCase
+
+@end
+
+@implementation PrestoArrayDiffTests
+
+- (void)setUp {
+	[super setUp];
+	
+	[PrestoStubServer reset];
+	[Presto defaultInstance].sessionConfiguration = [PrestoStubServer sessionConfiguration];
+}
+
+- (void)tearDown {
+	[PrestoStubServer reset];
+	
+	[super tearDown];
+}
+
+#pragma mark - Index sets
+
+- (void)testInitialLoadInsertsEverything {
+	NSMutableArray *target = [self targetWithRecords:@[@1, @2, @3]];
+	
+	[self assertDiff:target.presto.lastDiff inserted:[NSIndexSet indexSetWithIndexesInRange:NSMakeRange(0, 3)] removed:[NSIndexSet indexSet] updated:[NSIndexSet indexSet] moves:@[]];
+	XCTAssertEqualObjects([self recordIDsOf:target], (@[@1, @2, @3]));
+}
+
+- (void)testIdenticalReloadHasNoChanges {
+	NSMutableArray *target = [self targetWithRecords:@[@1, @2, @3]];
+	NSArray *instances = [target copy];
+	
+	XCTAssertFalse([target.presto loadWithArray:[self records:@[@1, @2, @3]]]);
+	XCTAssertFalse(target.presto.lastDiff.hasChanges);
+	XCTAssertEqualObjects(target, instances);
+	for (NSUInteger i = 0; i < instances.count; i++)
+		XCTAssertEqual(target[i], instances[i]); // loaded in place, not replaced
+}
+
+- (void)testInsert {
+	NSMutableArray *target = [self targetWithRecords:@[@1, @2, @3]];
+	
+	XCTAssertTrue([target.presto loadWithArray:[self records:@[@1, @5, @2, @3, @6]]]);
+	[self assertDiff:target.presto.lastDiff inserted:[self indexes:@[@1, @4]] removed:[NSIndexSet indexSet] updated:[NSIndexSet indexSet] moves:@[]];
+	XCTAssertEqualObjects([self recordIDsOf:target], (@[@1, @5, @2, @3, @6]));
+}
+
+- (void)testDelete {
+	NSMutableArray *target = [self targetWithRecords:@[@1, @2, @3, @4]];
+	
+	XCTAssertTrue([target.presto loadWithArray:[self records:@[@1, @3]]]);
+	[self assertDiff:target.presto.lastDiff inserted:[NSIndexSet indexSet] removed:[self indexes:@[@1, @3]] updated:[NSIndexSet indexSet] moves:@[]];
+	XCTAssertEqualObjects([self recordIDsOf:target], (@[@1, @3]));
+}
+
+- (void)testUpdate {
+	NSMutableArray *target = [self targetWithRecords:@[@1, @2, @3]];
+	PrestoDiffRecord *second = target[1];
+	
+	XCTAssertTrue([target.presto loadWithArray:[self records:@[@1, @2, @3] renaming:@{@2: @"renamed"}]]);
+	[self assertDiff:target.presto.lastDiff inserted:[NSIndexSet indexSet] removed:[NSIndexSet indexSet] updated:[self indexes:@[@1]] moves:@[]];
+	XCTAssertEqual(target[1], second);
+	XCTAssertEqualObjects(second.name, @"renamed");
+}
+
+- (void)testReorder {
+	NSMutableArray *target = [self targetWithRecords:@[@1, @2, @3, @4]];
+	
+	// only the element that left the others' relative order is reported as moved
+	XCTAssertTrue([target.presto loadWithArray:[self records:@[@4, @1, @2, @3]]]);
+	[self assertDiff:target.presto.lastDiff inserted:[NSIndexSet indexSet] removed:[NSIndexSet indexSet] updated:[NSIndexSet indexSet] moves:@[@[@3, @0]]];
+	XCTAssertEqualObjects([self recordIDsOf:target], (@[@4, @1, @2, @3]));
+}
+
+- (void)testReorderWithInsertAndDelete {
+	NSMutableArray *target = [self targetWithRecords:@[@1, @2, @3, @4, @5]];
+	
+	// 1 and 4 swap places; 2 goes, 6 comes, and 3 and 5 merely shift
+	XCTAssertTrue([target.presto loadWithArray:[self records:@[@4, @3, @6, @1, @5]]]);
+	PrestoArrayDiff *diff = target.presto.lastDiff;
+	XCTAssertEqualObjects(diff.insertedIndexes, [self indexes:@[@2]]);
+	XCTAssertEqualObjects(diff.removedIndexes, [self indexes:@[@1]]);
+	XCTAssertEqual(diff.moves.count, 2); // of the survivors 1, 3, 4 and 5, at most two can stay in relative order
+	XCTAssertEqualObjects([self recordIDsOf:target], (@[@4, @3, @6, @1, @5]));
+}
+
+- (void)testDuplicatesAreMatchedInOrder {
+	// raw values have no key, so equal elements are matched first-come first-served
+	NSMutableArray *target = [NSMutableArray new];
+	[target.presto loadWithArray:@[@"a", @"b", @"a", @"c"]];
+	
+	XCTAssertTrue([target.presto loadWithArray:@[@"a", @"a", @"a"]]);
+	[self assertDiff:target.presto.lastDiff inserted:[self indexes:@[@2]] removed:[self indexes:@[@1, @3]] updated:[NSIndexSet indexSet] moves:@[]];
+	XCTAssertEqualObjects(target, (@[@"a", @"a", @"a"]));
+}
+
+#pragma mark - Windows
+
+- (void)testElementsOutsideTheWindowAreMergedInPlace {
+	NSMutableArray *target = [self targetWithRecords:@[@1, @2, @3, @4]];
+	PrestoDiffRecord *fourth = target[3];
+	
+	// the window only covers 1 and 2; 4 is already further along, so it's loaded where it is rather than duplicated
+	XCTAssertTrue([target.presto loadWithArray:[self records:@[@2, @4, @5] renaming:@{@4: @"renamed"}] inWindow:NSMakeRange(0, 2)]);
+	[self assertDiff:target.presto.lastDiff inserted:[self indexes:@[@1]] removed:[self indexes:@[@0]] updated:[self indexes:@[@3]] moves:@[]];
+	XCTAssertEqualObjects([self recordIDsOf:target], (@[@2, @5, @3, @4]));
+	XCTAssertEqual(target[3], fourth);
+	XCTAssertEqualObjects(fourth.name, @"renamed");
+}
+
+- (void)testEmptyWindowAppends {
+	NSMutableArray *target = [self targetWithRecords:@[@1, @2]];
+	
+	XCTAssertTrue([target.presto loadWithArray:[self records:@[@3, @4]] inWindow:NSMakeRange(2, 0)]);
+	[self assertDiff:target.presto.lastDiff inserted:[self indexes:@[@2, @3]] removed:[NSIndexSet indexSet] updated:[NSIndexSet indexSet] moves:@[]];
+	XCTAssertEqualObjects([self recordIDsOf:target], (@[@1, @2, @3, @4]));
+}
+
+#pragma mark - Pages
+
+- (void)testPagesAppendAndFirstPageRefreshLeavesThemInPlace {
+	[PrestoStubServer respondTo:@"page1" withBody:[self JSONDataWithRecords:@[@1, @2] renaming:nil] contentType:@"application/json"];
+	[PrestoStubServer respondTo:@"page2" withBody:[self JSONDataWithRecords:@[@3, @4] renaming:nil] contentType:@"application/json"];
+	NSURL *secondPage = [PrestoStubServer URLForPath:@"page2"];
+	
+	NSMutableArray *target = [NSMutableArray new];
+	XCTestExpectation *firstLoaded = [self expectationWithDescription:@"first page"];
+	[[[[target.presto getFromURL:[PrestoStubServer URLForPath:@"page1"]] withClass:[PrestoDiffRecord class] atDepth:1] withPagination:^NSURL *(id responseObject, NSURL *pageURL) {
+		return [pageURL.lastPathComponent isEqualToString:@"page1"] ? secondPage : nil;
+	}] onComplete:^(NSObject *result) {
+		[firstLoaded fulfill];
+	}];
+	[self waitForExpectations:@[firstLoaded] timeout:10];
+	XCTAssertEqualObjects([self recordIDsOf:target], (@[@1, @2]));
+	XCTAssertTrue(target.presto.hasMorePages);
+	
+	XCTestExpectation *secondLoaded = [self expectationWithDescription:@"second page"];
+	[[target.presto loadNextPage] onComplete:^(NSObject *result) {
+		[secondLoaded fulfill];
+	}];
+	[self waitForExpectations:@[secondLoaded] timeout:10];
+	XCTAssertEqualObjects([self recordIDsOf:target], (@[@1, @2, @3, @4]));
+	[self assertDiff:target.presto.lastDiff inserted:[self indexes:@[@2, @3]] removed:[NSIndexSet indexSet] updated:[NSIndexSet indexSet] moves:@[]];
+	XCTAssertFalse(target.presto.hasMorePages);
+	
+	// the first page changes underneath us: 1 is renamed, 2 goes and 5 takes its place
+	[PrestoStubServer respondTo:@"page1" withBody:[self JSONDataWithRecords:@[@1, @5] renaming:@{@1: @"renamed"}] contentType:@"application/json"];
+	XCTestExpectation *refreshed = [self expectationWithDescription:@"refreshed"];
+	[target.presto reloadWithCompletion:^(NSObject *result) {
+		[refreshed fulfill];
+	}];
+	[self waitForExpectations:@[refreshed] timeout:10];
+	
+	XCTAssertEqualObjects([self recordIDsOf:target], (@[@1, @5, @3, @4])); // the second page is still there
+	[self assertDiff:target.presto.lastDiff inserted:[self indexes:@[@1]] removed:[self indexes:@[@1]] updated:[self indexes:@[@0]] moves:@[]];
+	XCTAssertEqualObjects(((PrestoDiffRecord *)target[0]).name, @"renamed");
+	XCTAssertFalse(target.presto.hasMorePages); // and so is its cursor
+}
+
+#pragma mark - Groups
+
+- (void)testGroupCompletionFailsIfAnyMemberFails {
+	[PrestoStubServer respondTo:@"loaded" withBody:[self JSONDataWithRecords:@[@1] renaming:nil] contentType:@"application/json"];
+	
+	NSMutableArray *loaded = [NSMutableArray new];
+	XCTestExpectation *memberLoaded = [self expectationWithDescription:@"member loaded"];
+	[[loaded.presto getFromURL:[PrestoStubServer URLForPath:@"loaded"]] onComplete:^(NSObject *result) {
+		[memberLoaded fulfill];
+	}];
+	[self waitForExpectations:@[memberLoaded] timeout:10];
+	
+	// one member has already loaded when the group subscribes, the other is still to fail (nothing is registered for it, so it's a 404)
+	NSMutableArray *failing = [NSMutableArray new];
+	[failing.presto getFromURL:[PrestoStubServer URLForPath:@"missing"]];
+	
+	XCTestExpectation *groupFailed = [self expectationWithDescription:@"group failed"];
+	__block NSUInteger calls = 0;
+	[@[loaded, failing].presto onComplete:^(NSObject *result) {
+		XCTFail(@"the group succeeded although a member failed");
+	} failure:^(NSObject *result) {
+		calls++;
+		[groupFailed fulfill];
+	}];
+	[self waitForExpectations:@[groupFailed] timeout:10];
+	
+	XCTAssertEqual(calls, 1);
+	XCTAssertEqual(loaded.count, 1);
+}
+
+- (void)testGroupCompletionSucceedsOnceEveryMemberHasLoaded {
+	[PrestoStubServer respondTo:@"first" withBody:[self JSONDataWithRecords:@[@1] renaming:nil] contentType:@"application/json"];
+	[PrestoStubServer respondTo:@"second" withBody:[self JSONDataWithRecords:@[@2, @3] renaming:nil] contentType:@"application/json"];
+	
+	NSMutableArray *first = [NSMutableArray new];
+	NSMutableArray *second = [NSMutableArray new];
+	[first.presto getFromURL:[PrestoStubServer URLForPath:@"first"]];
+	[second.presto getFromURL:[PrestoStubServer URLForPath:@"second"]];
+	
+	XCTestExpectation *groupLoaded = [self expectationWithDescription:@"group loaded"];
+	[@[first, second].presto onComplete:^(NSObject *result) {
+		XCTAssertEqual(first.count, 1);
+		XCTAssertEqual(second.count, 2);
+		[groupLoaded fulfill];
+	} failure:^(NSObject *result) {
+		XCTFail(@"no member failed");
+	}];
+	[self waitForExpectations:@[groupLoaded] timeout:10];
+}
+
+#pragma mark -
+
+// records with the given IDs, each named after its ID unless renamed
+- (NSMutableArray *)records:(NSArray *)recordIDs renaming:(NSDictionary *)names {
+	NSMutableArray *records = [NSMutableArray new];
+	for (NSNumber *recordID in recordIDs)
+		[records addObject:[@{@"recordID": recordID, @"name": names[recordID] ?: recordID.stringValue} mutableCopy]];
+	return records;
+}
+
+- (NSMutableArray *)records:(NSArray *)recordIDs {
+	return [self records:recordIDs renaming:nil];
+}
+
+- (NSMutableArray *)targetWithRecords:(NSArray *)recordIDs {
+	NSMutableArray *target = [NSMutableArray new];
+	[[target.presto withClass:[PrestoDiffRecord class] atDepth:1] loadWithArray:[self records:recordIDs]];
+	return target;
+}
+
+- (NSArray *)recordIDsOf:(NSArray *)target {
+	return [target valueForKey:@"recordID"];
+}
+
+- (void)assertDiff:(PrestoArrayDiff *)diff inserted:(NSIndexSet *)inserted removed:(NSIndexSet *)removed updated:(NSIndexSet *)updated moves:(NSArray *)moves {
+	XCTAssertEqualObjects(diff.insertedIndexes, inserted);
+	XCTAssertEqualObjects(diff.removedIndexes, removed);
+	XCTAssertEqualObjects(diff.updatedIndexes, updated);
+	XCTAssertEqualObjects(diff.moves, moves);
+}
+
+- (NSData *)JSONDataWithRecords:(NSArray *)recordIDs renaming:(NSDictionary *)names {
+	return [PrestoSyntheticPayload JSONDataWithObject:[self records:recordIDs renaming:names]];
+}
+
+- (NSIndexSet *)indexes:(NSArray *)indexes {
+	NSMutableIndexSet *result = [NSMutableIndexSet new];
+	for (NSNumber *index in indexes)
+		[result addIndex:index.unsignedIntegerValue];
+	return result;
+}
+
+@end
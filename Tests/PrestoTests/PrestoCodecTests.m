@@ -0,0 +1,318 @@
+//  The MIT License (MIT)
+//
+//  Copyright © 2018 Logan Murray
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+#import <XCTest/XCTest.h>
+#import <compression.h>
+#import <zlib.h>
+#import "Presto.h"
+#import "PrestoTestSupport.h"
+
+// the codecs on their own, and as they are negotiated with (and sent to) the stand-in server
+@interface PrestoCodecTests : XCTestCase
+
+@end
+
+@implementation PrestoCodecTests
+
+- (void)setUp {
+	[super setUp];
+	
+	[PrestoStubServer reset];
+	[Presto defaultInstance].sessionConfiguration = [PrestoStubServer sessionConfiguration];
+}
+
+- (void)tearDown {
+	[Presto defaultInstance].responseCache = nil;
+	[PrestoStubServer reset];
+	
+	[super tearDown];
+}
+
+// a bit of everything, including the edges of each MessagePack length and integer form
+- (NSDictionary *)sampleObject {
+	NSMutableDictionary *object = [@{
+		@"string": @"plain",
+		@"unicode": @"naïve café – 日本語 🎉",
+		@"empty": @"",
+		@"true": @YES,
+		@"false": @NO,
+		@"null": [NSNull null],
+		@"double": @(3.141592653589793),
+		@"negativeDouble": @(-0.1),
+		@"nested": @{@"array": @[@1, @[@2, @[@3]], @{@"deep": @"yes"}], @"map": @{}},
+		@"emptyArray": @[],
+	} mutableCopy];
+	
+	NSArray *integers = @[@0, @1, @127, @128, @255, @256, @65535, @65536, @4294967295LL, @4294967296LL, @(INT64_MAX), @(UINT64_MAX),
+		@-1, @-32, @-33, @-128, @-129, @-32768, @-32769, @(INT32_MIN), @((long long)INT32_MIN - 1), @(INT64_MIN)];
+	object[@"integers"] = integers;
+	
+	for (NSNumber *length in @[@31, @32, @255, @256, @65535, @65536])
+		object[[NSString stringWithFormat:@"string%@", length]] = [@"" stringByPaddingToLength:length.unsignedIntegerValue withString:@"x" startingAtIndex:0];
+	
+	NSMutableArray *longArray = [NSMutableArray new];
+	for (NSUInteger i = 0; i < 70000; i++)
+		[longArray addObject:@(i % 200)];
+	object[@"longArray"] = longArray; // past the 16-bit array form
+	
+	NSMutableDictionary *wideMap = [NSMutableDictionary new];
+	for (NSUInteger i = 0; i < 20; i++)
+		wideMap[[NSString stringWithFormat:@"key%lu", (unsigned long)i]] = @(i);
+	object[@"wideMap"] = wideMap; // past the fixmap form
+	
+	return object;
+}
+
+#pragma mark - Round trips
+
+- (void)testJSONRoundTrip {
+	PrestoJSONCodec *codec = [PrestoJSONCodec new];
+	NSDictionary *object = [self sampleObject];
+	
+	id decoded = [codec objectWithData:[codec dataWithObject:object]];
+	XCTAssertEqualObjects(decoded, object);
+	XCTAssertTrue([decoded isKindOfClass:[NSMutableDictionary class]]);
+}
+
+- (void)testMessagePackRoundTrip {
+	PrestoMessagePackCodec *codec = [PrestoMessagePackCodec new];
+	NSDictionary *object = [self sampleObject];
+	
+	id decoded = [codec objectWithData:[codec dataWithObject:object]];
+	XCTAssertEqualObjects(decoded, object);
+	XCTAssertEqual([decoded[@"integers"][11] unsignedLongLongValue], UINT64_MAX);
+	XCTAssertEqual([decoded[@"integers"][21] longLongValue], INT64_MIN);
+	XCTAssertEqual(decoded[@"true"], @YES); // still a boolean, not 1
+	
+	// bound into targets in place, so the containers have to be mutable
+	XCTAssertTrue([decoded isKindOfClass:[NSMutableDictionary class]]);
+	XCTAssertTrue([decoded[@"nested"][@"array"] isKindOfClass:[NSMutableArray class]]);
+}
+
+- (void)testMessagePackEncodings {
+	PrestoMessagePackCodec *codec = [PrestoMessagePackCodec new];
+	
+	XCTAssertEqualObjects([codec dataWithObject:@127], [self bytes:(uint8_t[]){0x7f} length:1]);
+	XCTAssertEqualObjects([codec dataWithObject:@128], [self bytes:(uint8_t[]){0xcc, 0x80} length:2]);
+	XCTAssertEqualObjects([codec dataWithObject:@-32], [self bytes:(uint8_t[]){0xe0} length:1]);
+	XCTAssertEqualObjects([codec dataWithObject:@-33], [self bytes:(uint8_t[]){0xd0, 0xdf} length:2]);
+	XCTAssertEqualObjects([codec dataWithObject:@YES], [self bytes:(uint8_t[]){0xc3} length:1]);
+	XCTAssertEqualObjects([codec dataWithObject:[NSNull null]], [self bytes:(uint8_t[]){0xc0} length:1]);
+	XCTAssertEqualObjects([codec dataWithObject:@"a"], [self bytes:(uint8_t[]){0xa1, 'a'} length:2]);
+	XCTAssertEqualObjects([codec dataWithObject:@[]], [self bytes:(uint8_t[]){0x90} length:1]);
+	XCTAssertEqualObjects([codec dataWithObject:@{}], [self bytes:(uint8_t[]){0x80} length:1]);
+}
+
+- (void)testMessagePackExtensionsDecodeAsNull {
+	PrestoMessagePackCodec *codec = [PrestoMessagePackCodec new];
+	uint8_t bytes[] = {0x92, 0xd4, 0x01, 0x2a, 0xc7, 0x02, 0x01, 0xff, 0xff}; // [fixext 1, ext 8 of two bytes]
+	
+	XCTAssertEqualObjects([codec objectWithData:[self bytes:bytes length:sizeof(bytes)]], (@[[NSNull null], [NSNull null]]));
+}
+
+#pragma mark - Malformed input
+
+- (void)testMessagePackTruncated {
+	PrestoMessagePackCodec *codec = [PrestoMessagePackCodec new];
+	NSMutableArray *items = [PrestoSyntheticPayload items:20];
+	[items addObject:@{@"double": @(2.5), @"big": @(UINT64_MAX), @"string": [@"" stringByPaddingToLength:300 withString:@"y" startingAtIndex:0]}];
+	NSData *data = [codec dataWithObject:items];
+	
+	for (NSUInteger length = 0; length < data.length; length++)
+		XCTAssertNil([codec objectWithData:[data subdataWithRange:NSMakeRange(0, length)]], @"a prefix of %lu of %lu bytes decoded", (unsigned long)length, (unsigned long)data.length);
+	XCTAssertEqualObjects([codec objectWithData:data], items);
+}
+
+- (void)testMessagePackGarbage {
+	PrestoMessagePackCodec *codec = [PrestoMessagePackCodec new];
+	NSMutableData *trailing = [[codec dataWithObject:@{@"a": @1}] mutableCopy];
+	[trailing appendBytes:"\x01" length:1];
+	
+	XCTAssertNil([codec objectWithData:[NSData data]]);
+	XCTAssertNil([codec objectWithData:trailing]); // a whole value followed by anything else isn't a payload
+	XCTAssertNil([codec objectWithData:[self bytes:(uint8_t[]){0xc1} length:1]]); // never used
+	XCTAssertNil([codec objectWithData:[self bytes:(uint8_t[]){0xa2, 0xc3, 0x28} length:3]]); // not UTF-8
+	XCTAssertNil([codec objectWithData:[self bytes:(uint8_t[]){0xdd, 0xff, 0xff, 0xff, 0xff, 0x01} length:6]]); // claims four billion elements
+	XCTAssertNil([codec objectWithData:[self bytes:(uint8_t[]){0xdb, 0xff, 0xff, 0xff, 0xff, 'a'} length:6]]); // and a four gigabyte string
+	XCTAssertNil([codec objectWithData:[self bytes:(uint8_t[]){0x81, 0xc0} length:2]]); // a key without a value
+	
+	// arrays of one array of one array..., which would otherwise recurse until the stack runs out
+	NSMutableData *deep = [NSMutableData dataWithLength:300000];
+	memset(deep.mutableBytes, 0x91, deep.length);
+	[deep appendBytes:"\x01" length:1];
+	XCTAssertNil([codec objectWithData:deep]);
+	XCTAssertNotNil([codec objectWithData:[deep subdataWithRange:NSMakeRange(deep.length - 501, 501)]]); // reasonable nesting is still fine
+	
+	// whatever it makes of noise, it must not crash or read past the end
+	srand48(42);
+	for (NSUInteger i = 0; i < 2000; i++) {
+		NSUInteger length = 1 + lrand48() % 64;
+		NSMutableData *noise = [NSMutableData dataWithLength:length];
+		uint8_t *bytes = noise.mutableBytes;
+		for (NSUInteger j = 0; j < length; j++)
+			bytes[j] = (uint8_t)lrand48();
+		[codec objectWithData:[noise copy]];
+	}
+}
+
+- (void)testJSONGarbage {
+	PrestoJSONCodec *codec = [PrestoJSONCodec new];
+	NSData *data = [PrestoSyntheticPayload itemsJSONData:5];
+	
+	XCTAssertNil([codec objectWithData:[data subdataWithRange:NSMakeRange(0, data.length / 2)]]);
+	XCTAssertNil([codec objectWithData:[@"{\"a\": }" dataUsingEncoding:NSUTF8StringEncoding]]);
+	XCTAssertNil([codec objectWithData:[self bytes:(uint8_t[]){0x80, 0xff, 0x00} length:3]]);
+}
+
+#pragma mark - Against the server
+
+- (void)testMessagePackNegotiation {
+	NSArray *items = [PrestoSyntheticPayload items:10];
+	[PrestoStubServer respondTo:@"msgpack" withBody:[[PrestoMessagePackCodec new] dataWithObject:items] contentType:@"application/msgpack"];
+	
+	NSMutableArray *result = [self load:@"msgpack" withCodec:[PrestoMessagePackCodec new]];
+	
+	NSURLRequest *request = [PrestoStubServer receivedRequests].firstObject;
+	XCTAssertEqualObjects([request valueForHTTPHeaderField:@"Accept"], @"application/msgpack, application/json;q=0.9");
+	[self assertItems:result match:items];
+}
+
+- (void)testJSONResponseToMessagePackSource {
+	NSArray *items = [PrestoSyntheticPayload items:10];
+	[PrestoStubServer respondTo:@"json" withBody:[PrestoSyntheticPayload itemsJSONData:10] contentType:@"application/json; charset=utf-8"];
+	
+	[self assertItems:[self load:@"json" withCodec:[PrestoMessagePackCodec new]] match:items]; // the server doesn't have to speak it
+}
+
+- (void)testCachedResponseKeepsItsCodec {
+	NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+	PrestoResponseCache *cache = [[PrestoResponseCache alloc] initWithPath:path];
+	[Presto defaultInstance].responseCache = cache;
+	
+	NSArray *items = [PrestoSyntheticPayload items:10];
+	[PrestoStubServer respondTo:@"cached" withStatus:200 headers:@{@"Content-Type": @"application/msgpack", @"ETag": @"\"v1\""} body:[[PrestoMessagePackCodec new] dataWithObject:items]];
+	[self load:@"cached" withCodec:[PrestoMessagePackCodec new]];
+	
+	// reopened, so it comes off disk; the revalidation gets a 304, so only the cached copy can populate it
+	cache = [[PrestoResponseCache alloc] initWithPath:path];
+	[Presto defaultInstance].responseCache = cache;
+	[self assertItems:[self load:@"cached" withCodec:[PrestoMessagePackCodec new]] match:items];
+	XCTAssertEqualObjects([[PrestoStubServer receivedRequests].lastObject valueForHTTPHeaderField:@"If-None-Match"], @"\"v1\"");
+	
+	[cache removeAllEntries];
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testMessagePackRequestBody {
+	PrestoBenchItem *item = [self sampleItem];
+	[PrestoStubServer respondTo:@"post" withBody:[@"{}" dataUsingEncoding:NSUTF8StringEncoding] contentType:@"application/json"];
+	
+	[self send:[[item.presto postToURL:[PrestoStubServer URLForPath:@"post"]] withCodec:[PrestoMessagePackCodec new]]];
+	
+	NSURLRequest *request = [PrestoStubServer receivedRequests].firstObject;
+	XCTAssertEqualObjects([request valueForHTTPHeaderField:@"Content-Type"], @"application/msgpack");
+	XCTAssertEqualObjects([[PrestoMessagePackCodec new] objectWithData:request.HTTPBody], [item.presto toDictionary]);
+}
+
+- (void)testCompressedRequestBody {
+	PrestoBenchItem *item = [self sampleItem];
+	[PrestoStubServer respondTo:@"post" withBody:[@"{}" dataUsingEncoding:NSUTF8StringEncoding] contentType:@"application/json"];
+	
+	[self send:[[item.presto postToURL:[PrestoStubServer URLForPath:@"post"]] withCompressedPayload]];
+	
+	NSURLRequest *request = [PrestoStubServer receivedRequests].firstObject;
+	NSData *body = request.HTTPBody;
+	const uint8_t *bytes = body.bytes;
+	XCTAssertEqualObjects([request valueForHTTPHeaderField:@"Content-Encoding"], @"gzip");
+	XCTAssertGreaterThan(body.length, 18);
+	XCTAssertEqual(bytes[0], 0x1f);
+	XCTAssertEqual(bytes[1], 0x8b);
+	XCTAssertEqual(bytes[2], 8); // deflate
+	XCTAssertEqual(bytes[3], 0); // no optional fields, so the deflate stream starts right after the 10-byte header
+	
+	// inflate it independently of how it was deflated, then check the trailer against the result
+	uint8_t *inflated = malloc(64 * 1024);
+	size_t inflatedLength = compression_decode_buffer(inflated, 64 * 1024, bytes + 10, body.length - 18, NULL, COMPRESSION_ZLIB);
+	NSData *payload = [NSData dataWithBytesNoCopy:inflated length:inflatedLength freeWhenDone:YES];
+	
+	const uint8_t *trailer = bytes + body.length - 8;
+	uint32_t crc = trailer[0] | trailer[1] << 8 | trailer[2] << 16 | (uint32_t)trailer[3] << 24;
+	uint32_t size = trailer[4] | trailer[5] << 8 | trailer[6] << 16 | (uint32_t)trailer[7] << 24;
+	XCTAssertEqual(size, (uint32_t)payload.length);
+	XCTAssertEqual(crc, (uint32_t)crc32(0, payload.bytes, (uInt)payload.length));
+	XCTAssertEqualObjects([NSJSONSerialization JSONObjectWithData:payload options:0 error:nil], [item.presto toDictionary]);
+}
+
+#pragma mark -
+
+- (NSData *)bytes:(const uint8_t *)bytes length:(NSUInteger)length {
+	return [NSData dataWithBytes:bytes length:length];
+}
+
+- (PrestoBenchItem *)sampleItem {
+	PrestoBenchItem *item = [PrestoBenchItem new];
+	item.itemID = @7;
+	item.name = @"Item 7";
+	item.summary = [@"" stringByPaddingToLength:2000 withString:@"compressible " startingAtIndex:0];
+	item.price = @(8.75);
+	item.inStock = @YES;
+	item.tags = [@[@"tag0", @"tag7"] mutableCopy];
+	return item;
+}
+
+- (NSMutableArray *)load:(NSString *)path withCodec:(id<PrestoCodec>)codec {
+	NSMutableArray *items = [NSMutableArray new];
+	XCTestExpectation *completed = [self expectationWithDescription:@"completed"];
+	[[[[items.presto getFromURL:[PrestoStubServer URLForPath:path]] withCodec:codec] withClass:[PrestoBenchItem class] atDepth:1] onComplete:^(NSObject *result) {
+		[completed fulfill];
+	} failure:^(NSObject *result) {
+		XCTFail(@"%@", items.presto.error);
+		[completed fulfill];
+	}];
+	
+	[self waitForExpectations:@[completed] timeout:10];
+	[items.presto clearDependencies];
+	return items;
+}
+
+- (void)send:(PrestoMetadata *)request {
+	XCTestExpectation *completed = [self expectationWithDescription:@"completed"];
+	[[request reload] onComplete:^(NSObject *result) {
+		[completed fulfill];
+	} failure:^(NSObject *result) {
+		XCTFail(@"%@", request.error);
+		[completed fulfill];
+	}];
+	[self waitForExpectations:@[completed] timeout:10];
+}
+
+- (void)assertItems:(NSArray *)items match:(NSArray *)records {
+	XCTAssertEqual(items.count, records.count);
+	[items enumerateObjectsUsingBlock:^(PrestoBenchItem *item, NSUInteger i, BOOL *stop) {
+		XCTAssertTrue([item isKindOfClass:[PrestoBenchItem class]]);
+		XCTAssertEqualObjects(item.itemID, records[i][@"itemID"]);
+		XCTAssertEqualObjects(item.summary, records[i][@"summary"]);
+		XCTAssertEqualObjects(item.tags, records[i][@"tags"]);
+	}];
+}
+
+@end
@@ -0,0 +1,145 @@
+//  The MIT License (MIT)
+//
+//  Copyright © 2018 Logan Murray
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+#import <XCTest/XCTest.h>
+#import <UIKit/UIKit.h>
+#import "Presto.h"
+#import "PrestoTestSupport.h"
+
+// the request queue: coalescing equivalent requests and cancelling the ones nothing is waiting on
+@interface PrestoRequestTests : XCTestCase
+
+@end
+
+@implementation PrestoRequestTests
+
+- (void)setUp {
+	[super setUp];
+	
+	[PrestoStubServer reset];
+	[Presto defaultInstance].sessionConfiguration = [PrestoStubServer sessionConfiguration];
+	[PrestoStubServer respondTo:@"items" withBody:[PrestoSyntheticPayload itemsJSONData:10] contentType:@"application/json"];
+}
+
+- (void)tearDown {
+	[[Presto defaultInstance] resumeRefreshing];
+	[Presto defaultInstance].pausesRefreshingInBackground = YES;
+	[PrestoStubServer reset];
+	
+	[super tearDown];
+}
+
+// lets the main queue run for a while, so queued loads start and deallocation observers fire
+- (void)waitFor:(NSTimeInterval)interval {
+	XCTestExpectation *waited = [self expectationWithDescription:@"waited"];
+	dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(interval * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+		[waited fulfill];
+	});
+	[self waitForExpectations:@[waited] timeout:interval + 5];
+}
+
+- (void)testEquivalentRequestsAreCoalesced {
+	[PrestoStubServer setLatency:0.3];
+	NSURL *url = [PrestoStubServer URLForPath:@"items"];
+	NSMutableArray *first = [NSMutableArray new];
+	NSMutableArray *second = [NSMutableArray new];
+	XCTestExpectation *firstCompleted = [self expectationWithDescription:@"first completed"];
+	XCTestExpectation *secondCompleted = [self expectationWithDescription:@"second completed"];
+	
+	[[[first.presto getFromURL:url] withClass:[PrestoBenchItem class] atDepth:1] onComplete:^(NSObject *result) {
+		[firstCompleted fulfill];
+	}];
+	[[[second.presto getFromURL:url] withClass:[PrestoBenchItem class] atDepth:1] onComplete:^(NSObject *result) {
+		[secondCompleted fulfill];
+	}];
+	[self waitForExpectations:@[firstCompleted, secondCompleted] timeout:10];
+	
+	XCTAssertEqual(first.count, 10);
+	XCTAssertEqual(second.count, 10);
+	XCTAssertEqual([PrestoStubServer receivedRequests].count, 1);
+}
+
+// a request cancelled because its target went away mustn't swallow a later equivalent request that somebody is waiting on
+- (void)testRequestAfterZombieCancellationCompletes {
+	[PrestoStubServer setLatency:0.3];
+	NSURL *url = [PrestoStubServer URLForPath:@"items"];
+	
+	@autoreleasepool {
+		NSMutableArray *abandoned = [NSMutableArray new];
+		[[abandoned.presto getFromURL:url] withClass:[PrestoBenchItem class] atDepth:1];
+		[self waitFor:0.1]; // in flight, but not yet answered
+	}
+	[self waitFor:0.05]; // the cancellation is dispatched to the target queue
+	
+	NSMutableArray *items = [NSMutableArray new];
+	XCTestExpectation *completed = [self expectationWithDescription:@"completed"];
+	[[[items.presto getFromURL:url] withClass:[PrestoBenchItem class] atDepth:1] onComplete:^(NSObject *result) {
+		[completed fulfill];
+	}];
+	[self waitForExpectations:@[completed] timeout:10];
+	
+	XCTAssertEqual(items.count, 10);
+	XCTAssertEqual([PrestoStubServer receivedRequests].count, 2);
+}
+
+// tokens split across many small chunks, including escapes that straddle them
+- (void)testStreamedResponseInSmallChunks {
+	NSMutableString *longString = [NSMutableString new];
+	for (NSUInteger i = 0; i < 2000; i++)
+		[longString appendFormat:@"line %lu \"quoted\" \\ caf\u00e9\n", (unsigned long)i];
+	NSDictionary *object = @{@"text": longString, @"number": @-12345.678e3, @"flags": @[@YES, @NO, [NSNull null]], @"items": [PrestoSyntheticPayload items:20]};
+	NSData *body = [PrestoSyntheticPayload JSONDataWithObject:object];
+	[PrestoStubServer respondTo:@"stream" withBody:body contentType:@"application/json"];
+	[PrestoStubServer setChunkSize:7];
+	
+	NSMutableDictionary *target = [NSMutableDictionary new];
+	XCTestExpectation *completed = [self expectationWithDescription:@"completed"];
+	[[[target.presto getFromURL:[PrestoStubServer URLForPath:@"stream"]] withStreamedResponse] onComplete:^(NSObject *result) {
+		[completed fulfill];
+	}];
+	[self waitForExpectations:@[completed] timeout:30];
+	
+	XCTAssertEqualObjects(target, [NSJSONSerialization JSONObjectWithData:body options:0 error:nil]);
+}
+
+- (void)testRefreshingPausesInBackground {
+	Presto *manager = [Presto defaultInstance];
+	NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
+	
+	[center postNotificationName:UIApplicationDidEnterBackgroundNotification object:nil];
+	XCTAssertTrue(manager.isRefreshPaused);
+	[center postNotificationName:UIApplicationWillEnterForegroundNotification object:nil];
+	XCTAssertFalse(manager.isRefreshPaused);
+	
+	// a pause the app asked for outlasts the background
+	[manager pauseRefreshing];
+	[center postNotificationName:UIApplicationDidEnterBackgroundNotification object:nil];
+	[center postNotificationName:UIApplicationWillEnterForegroundNotification object:nil];
+	XCTAssertTrue(manager.isRefreshPaused);
+	[manager resumeRefreshing];
+	
+	manager.pausesRefreshingInBackground = NO;
+	[center postNotificationName:UIApplicationDidEnterBackgroundNotification object:nil];
+	XCTAssertFalse(manager.isRefreshPaused);
+}
+
+@end